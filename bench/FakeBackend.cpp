@@ -0,0 +1,205 @@
+#include "PgWire.h"
+
+#include <csignal>
+#include <iostream>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <string>
+#include <thread>
+
+//  Fake PostgreSQL backend for loopback benchmarks
+//  Accepts any user without auth, answers every query with the same
+//  canned result set. Responses are built once, so its own cost stays
+//  far below the proxy under test
+
+struct BackendOptions {
+    std::size_t rows = 1;
+    std::size_t row_size = 16;
+};
+
+//  Pre-built replies
+struct Replies {
+    std::string startup;
+    std::string query;        //  Q: T, D * rows, C, Z
+    std::string execute;      //  E: D * rows, C
+    std::string describe_stmt;
+    std::string describe_portal;
+    std::string parse_complete;
+    std::string bind_complete;
+    std::string close_complete;
+    std::string ready;
+};
+
+static Replies build_replies(const BackendOptions& options) {
+    Replies r;
+
+    r.startup.clear();
+    std::string auth_ok;
+    pgwire::putInt32(auth_ok, 0);
+    pgwire::message(r.startup, 'R', auth_ok);
+    pgwire::message(r.startup, 'S', std::string("server_version\0" "16.0\0", 20));
+    pgwire::message(r.startup, 'S', std::string("client_encoding\0" "UTF8\0", 21));
+    std::string key;
+    pgwire::putInt32(key, 4242);
+    pgwire::putInt32(key, 4242);
+    pgwire::message(r.startup, 'K', key);
+    pgwire::message(r.startup, 'Z', "I");
+
+    //  One text column
+    std::string desc;
+    pgwire::putInt16(desc, 1);
+    desc += std::string("payload\0", 8);
+    pgwire::putInt32(desc, 0);       //  table oid
+    pgwire::putInt16(desc, 0);       //  column
+    pgwire::putInt32(desc, 25);      //  text
+    pgwire::putInt16(desc, 0xFFFF);  //  varlena
+    pgwire::putInt32(desc, 0xFFFFFFFF);
+    pgwire::putInt16(desc, 0);       //  text format
+    std::string row_description;
+    pgwire::message(row_description, 'T', desc);
+
+    std::string row;
+    pgwire::putInt16(row, 1);
+    pgwire::putInt32(row, static_cast<uint32_t>(options.row_size));
+    row.append(options.row_size, 'x');
+    std::string rows;
+    for (std::size_t i = 0; i < options.rows; i++) {
+        pgwire::message(rows, 'D', row);
+    }
+
+    std::string tag = "SELECT " + std::to_string(options.rows);
+    std::string complete;
+    pgwire::message(complete, 'C', std::string(tag.c_str(), tag.size() + 1));
+
+    pgwire::message(r.ready, 'Z', "I");
+    r.query = row_description + rows + complete + r.ready;
+    r.execute = rows + complete;
+
+    std::string no_params;
+    pgwire::putInt16(no_params, 0);
+    pgwire::message(r.describe_stmt, 't', no_params);
+    r.describe_stmt += row_description;
+    r.describe_portal = row_description;
+
+    pgwire::message(r.parse_complete, '1');
+    pgwire::message(r.bind_complete, '2');
+    pgwire::message(r.close_complete, '3');
+    return r;
+}
+
+static void serve(int fd, const Replies& replies) {
+    pgwire::Reader reader(fd);
+    std::string startup;
+
+    //  SSL/GSS are refused, client retries in plain text
+    while (true) {
+        if (!reader.startup(startup) || startup.size() < 4) {
+            close(fd);
+            return;
+        }
+        uint32_t code = pgwire::getInt32(startup.data());
+        if (code == pgwire::kSslRequest || code == pgwire::kGssRequest) {
+            if (!pgwire::sendAll(fd, "N", 1)) break;
+            continue;
+        }
+        if (code != pgwire::kProtocolV3) {
+            close(fd);
+            return;
+        }
+        break;
+    }
+
+    if (!pgwire::sendAll(fd, replies.startup)) {
+        close(fd);
+        return;
+    }
+
+    std::string out;
+    char type;
+    const char* body;
+    uint32_t len;
+    bool open = true;
+
+    while (open && reader.next(type, body, len)) {
+        switch (type) {
+            case 'Q': out += replies.query; break;
+            case 'P': out += replies.parse_complete; break;
+            case 'B': out += replies.bind_complete; break;
+            case 'E': out += replies.execute; break;
+            case 'C': out += replies.close_complete; break;
+            case 'S': out += replies.ready; break;
+            case 'D':
+                out += (len > 0 && body[0] == 'S') ? replies.describe_stmt : replies.describe_portal;
+                break;
+            case 'X': open = false; break;
+            default: break;  //  H and anything else: no reply
+        }
+
+        //  Pipelined input is answered with one send
+        if (!reader.buffered() || out.size() >= 256 * 1024) {
+            if (!out.empty() && !pgwire::sendAll(fd, out)) break;
+            out.clear();
+        }
+    }
+
+    close(fd);
+}
+
+static void usage(const char* prog) {
+    std::cerr << "Usage: " << prog << " <host> <port> [--rows N] [--row-size N]\n";
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 3) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    std::string host = argv[1];
+    uint16_t port = static_cast<uint16_t>(std::stoi(argv[2]));
+    BackendOptions options;
+
+    for (int i = 3; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--rows" && i + 1 < argc) {
+            options.rows = std::stoul(argv[++i]);
+        } else if (arg == "--row-size" && i + 1 < argc) {
+            options.row_size = std::stoul(argv[++i]);
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    static const Replies replies = build_replies(options);
+
+    int listener = ::socket(AF_INET, SOCK_STREAM, 0);
+    int opt = 1;
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, host.c_str(), &addr.sin_addr) <= 0 ||
+        bind(listener, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == -1 ||
+        listen(listener, SOMAXCONN) == -1) {
+        perror("listen");
+        return 1;
+    }
+
+    std::cout << "Fake backend on " << host << ":" << port << " rows=" << options.rows
+              << " row_size=" << options.row_size << std::endl;
+
+    //  Thread per connection, bench connection counts are small
+    while (true) {
+        int fd = accept(listener, nullptr, nullptr);
+        if (fd == -1) {
+            if (errno == EINTR) continue;
+            perror("accept");
+            return 1;
+        }
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+        std::thread(serve, fd, std::cref(replies)).detach();
+    }
+}
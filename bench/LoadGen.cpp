@@ -0,0 +1,401 @@
+#include "PgWire.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+//  Closed-loop load generator: each connection sends a batch of `depth`
+//  queries, waits for all replies, repeats. Latency of a query is batch
+//  send -> its CommandComplete
+//  With --direct-port the same load runs against the backend first, then a
+//  paired phase: each connection alternates a batch on the backend and the
+//  same batch through the proxy, added latency is proxy - direct per query
+
+using Clock = std::chrono::steady_clock;
+
+struct LoadOptions {
+    std::string host = "127.0.0.1";
+    uint16_t port = 0;
+    uint16_t direct_port = 0;   //  0: no baseline phase
+    int proxy_pid = 0;          //  0: no CPU accounting
+    unsigned conns = 16;
+    unsigned depth = 1;
+    double duration = 5.0;      //  seconds, measured part
+    double warmup = 1.0;
+    bool extended = false;      //  P/B/E/S instead of Q
+};
+
+struct PhaseResult {
+    uint64_t queries = 0;
+    double seconds = 0;
+    double p50 = 0, p99 = 0, p999 = 0;  //  microseconds
+    double cpu_us_per_query = -1;
+    unsigned failed = 0;
+};
+
+//  utime + stime of a process, in microseconds
+static double process_cpu_us(int pid) {
+    std::ifstream in("/proc/" + std::to_string(pid) + "/stat");
+    std::string stat;
+    std::getline(in, stat);
+
+    //  comm may contain spaces, fields start after the closing paren
+    std::size_t paren = stat.rfind(')');
+    if (paren == std::string::npos) return -1;
+    std::istringstream fields(stat.substr(paren + 2));
+    std::string skip;
+    for (int i = 3; i < 14; i++) fields >> skip;
+    unsigned long utime = 0, stime = 0;
+    fields >> utime >> stime;
+    return static_cast<double>(utime + stime) * 1e6 / static_cast<double>(sysconf(_SC_CLK_TCK));
+}
+
+static int connect_to(const std::string& host, uint16_t port) {
+    int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+    if (fd == -1) return -1;
+
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    inet_pton(AF_INET, host.c_str(), &addr.sin_addr);
+    if (::connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == -1) {
+        close(fd);
+        return -1;
+    }
+
+    int opt = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+    return fd;
+}
+
+//  One batch worth of requests, built once per connection
+static std::string build_batch(const LoadOptions& options, unsigned conn_id) {
+    std::string out;
+    for (unsigned i = 0; i < options.depth; i++) {
+        if (!options.extended) {
+            std::string sql = "SELECT payload FROM bench WHERE id = " + std::to_string(conn_id * 1000 + i);
+            pgwire::message(out, 'Q', std::string(sql.c_str(), sql.size() + 1));
+            continue;
+        }
+
+        static const char kParse[] = "\0SELECT payload FROM bench WHERE id = $1 AND tag = $2";
+        std::string parse(kParse, sizeof(kParse));  //  Unnamed statement, query, both with \0
+        pgwire::putInt16(parse, 0);
+        pgwire::message(out, 'P', parse);
+
+        std::string id = std::to_string(conn_id * 1000 + i);
+        std::string bind("\0\0", 2);  //  unnamed portal and statement
+        pgwire::putInt16(bind, 0);    //  all params text
+        pgwire::putInt16(bind, 2);
+        pgwire::putInt32(bind, static_cast<uint32_t>(id.size()));
+        bind += id;
+        pgwire::putInt32(bind, 5);
+        bind += "bench";
+        pgwire::putInt16(bind, 0);
+        pgwire::message(out, 'B', bind);
+
+        std::string execute("\0", 1);
+        pgwire::putInt32(execute, 0);
+        pgwire::message(out, 'E', execute);
+    }
+    if (options.extended) {
+        pgwire::message(out, 'S');
+    }
+    return out;
+}
+
+static bool handshake(int fd, pgwire::Reader& reader) {
+    std::string body;
+    pgwire::putInt32(body, pgwire::kProtocolV3);
+    body += std::string("user\0bench\0database\0bench\0\0", 27);
+    std::string startup;
+    pgwire::putInt32(startup, static_cast<uint32_t>(body.size() + 4));
+    startup += body;
+    if (!pgwire::sendAll(fd, startup)) return false;
+
+    char type;
+    const char* msg;
+    uint32_t len;
+    while (reader.next(type, msg, len)) {
+        if (type == 'Z') return true;
+        if (type == 'E') return false;
+    }
+    return false;
+}
+
+//  One batch round trip, ns from send to each CommandComplete
+static bool run_batch(int fd, pgwire::Reader& reader, const std::string& batch, unsigned ready_per_batch,
+                      std::vector<int64_t>& latencies) {
+    latencies.clear();
+    Clock::time_point sent = Clock::now();
+    if (!pgwire::sendAll(fd, batch)) return false;
+
+    unsigned ready = 0;
+    char type;
+    const char* msg;
+    uint32_t len;
+    while (ready < ready_per_batch) {
+        if (!reader.next(type, msg, len) || type == 'E') return false;
+        if (type == 'C') {
+            latencies.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - sent).count());
+        } else if (type == 'Z') {
+            ready++;
+        }
+    }
+    return true;
+}
+
+//  Connected and past startup, Terminate on destruction
+struct Session {
+    int fd = -1;
+    std::unique_ptr<pgwire::Reader> reader;
+
+    bool open(const LoadOptions& options, uint16_t port) {
+        fd = connect_to(options.host, port);
+        if (fd == -1) return false;
+        reader = std::make_unique<pgwire::Reader>(fd);
+        return handshake(fd, *reader);
+    }
+
+    ~Session() {
+        if (fd == -1) return;
+        std::string terminate;
+        pgwire::message(terminate, 'X');
+        pgwire::sendAll(fd, terminate);
+        close(fd);
+    }
+};
+
+//  Latencies in nanoseconds, only those of batches sent inside the window
+static bool run_connection(const LoadOptions& options, uint16_t port, unsigned conn_id,
+                           Clock::time_point start, Clock::time_point stop,
+                           std::vector<uint32_t>& latencies) {
+    Session session;
+    if (!session.open(options, port)) return false;
+
+    const std::string batch = build_batch(options, conn_id);
+    const unsigned ready_per_batch = options.extended ? 1 : options.depth;
+    std::vector<int64_t> round;
+    bool ok = true;
+
+    while (ok) {
+        Clock::time_point sent = Clock::now();
+        if (sent >= stop) break;
+        ok = run_batch(session.fd, *session.reader, batch, ready_per_batch, round);
+        if (ok && sent >= start) {
+            for (int64_t ns : round) {
+                latencies.push_back(static_cast<uint32_t>(std::min<int64_t>(ns, UINT32_MAX)));
+            }
+        }
+    }
+
+    return ok;
+}
+
+//  Same batch on the backend and through the proxy, back to back on one thread,
+//  so both see the same load; proxy - direct per query, can be < 0 on noise
+static bool run_paired_connection(const LoadOptions& options, unsigned conn_id,
+                                  Clock::time_point start, Clock::time_point stop,
+                                  std::vector<int64_t>& added) {
+    Session direct_session, proxy_session;
+    if (!direct_session.open(options, options.direct_port) || !proxy_session.open(options, options.port)) {
+        return false;
+    }
+
+    const std::string batch = build_batch(options, conn_id);
+    const unsigned ready_per_batch = options.extended ? 1 : options.depth;
+    std::vector<int64_t> direct, proxy;
+    bool ok = true;
+
+    while (ok) {
+        Clock::time_point sent = Clock::now();
+        if (sent >= stop) break;
+        ok = run_batch(direct_session.fd, *direct_session.reader, batch, ready_per_batch, direct)
+          && run_batch(proxy_session.fd, *proxy_session.reader, batch, ready_per_batch, proxy);
+        if (ok && sent >= start) {
+            for (std::size_t i = 0; i < std::min(direct.size(), proxy.size()); i++) {
+                added.push_back(proxy[i] - direct[i]);
+            }
+        }
+    }
+
+    return ok;
+}
+
+template <typename T>
+static double percentile(const std::vector<T>& sorted, double q) {
+    if (sorted.empty()) return 0;
+    std::size_t idx = static_cast<std::size_t>(q * static_cast<double>(sorted.size() - 1));
+    return static_cast<double>(sorted[idx]) / 1000.0;
+}
+
+//  Measured window after the warmup, from now
+static std::pair<Clock::time_point, Clock::time_point> phase_window(const LoadOptions& options) {
+    auto start = Clock::now() + std::chrono::duration_cast<Clock::duration>(
+                                    std::chrono::duration<double>(options.warmup));
+    auto stop = start + std::chrono::duration_cast<Clock::duration>(
+                            std::chrono::duration<double>(options.duration));
+    return { start, stop };
+}
+
+static PhaseResult run_phase(const LoadOptions& options, uint16_t port, int pid) {
+    auto [start, stop] = phase_window(options);
+
+    std::vector<std::vector<uint32_t>> latencies(options.conns);
+    std::atomic<unsigned> failed{0};
+    std::vector<std::thread> threads;
+
+    for (unsigned i = 0; i < options.conns; i++) {
+        latencies[i].reserve(1 << 16);
+        threads.emplace_back([&, i] {
+            if (!run_connection(options, port, i, start, stop, latencies[i])) failed++;
+        });
+    }
+
+    //  CPU is sampled on the same window as latencies
+    double cpu_before = -1, cpu_after = -1;
+    if (pid > 0) {
+        std::this_thread::sleep_until(start);
+        cpu_before = process_cpu_us(pid);
+        std::this_thread::sleep_until(stop);
+        cpu_after = process_cpu_us(pid);
+    }
+
+    for (auto& t : threads) t.join();
+
+    std::vector<uint32_t> all;
+    for (auto& l : latencies) all.insert(all.end(), l.begin(), l.end());
+    std::sort(all.begin(), all.end());
+
+    PhaseResult result;
+    result.queries = all.size();
+    result.seconds = options.duration;
+    result.p50 = percentile(all, 0.50);
+    result.p99 = percentile(all, 0.99);
+    result.p999 = percentile(all, 0.999);
+    result.failed = failed.load();
+    if (cpu_before >= 0 && cpu_after >= 0 && result.queries > 0) {
+        result.cpu_us_per_query = (cpu_after - cpu_before) / static_cast<double>(result.queries);
+    }
+    return result;
+}
+
+//  Percentiles of the per-query proxy - direct differences, qps is of both targets together
+static PhaseResult run_paired_phase(const LoadOptions& options) {
+    auto [start, stop] = phase_window(options);
+
+    std::vector<std::vector<int64_t>> added(options.conns);
+    std::atomic<unsigned> failed{0};
+    std::vector<std::thread> threads;
+
+    for (unsigned i = 0; i < options.conns; i++) {
+        added[i].reserve(1 << 16);
+        threads.emplace_back([&, i] {
+            if (!run_paired_connection(options, i, start, stop, added[i])) failed++;
+        });
+    }
+    for (auto& t : threads) t.join();
+
+    std::vector<int64_t> all;
+    for (auto& a : added) all.insert(all.end(), a.begin(), a.end());
+    std::sort(all.begin(), all.end());
+
+    PhaseResult result;
+    result.queries = all.size();
+    result.seconds = options.duration;
+    result.p50 = percentile(all, 0.50);
+    result.p99 = percentile(all, 0.99);
+    result.p999 = percentile(all, 0.999);
+    result.failed = failed.load();
+    return result;
+}
+
+static void print_row(const char* name, const PhaseResult& r) {
+    std::printf("%-8s %12.0f %10.1f %10.1f %10.1f", name, r.queries / r.seconds, r.p50, r.p99, r.p999);
+    if (r.failed) std::printf("   (%u connections failed)", r.failed);
+    std::printf("\n");
+}
+
+static void usage(const char* prog) {
+    std::cerr << "Usage: " << prog << " <host> <port> [options]\n"
+              << "Options:\n"
+              << "  --conns N         concurrent connections (default 16)\n"
+              << "  --depth N         queries pipelined per round trip (default 1)\n"
+              << "  --duration S      measured seconds (default 5)\n"
+              << "  --warmup S        unmeasured seconds first (default 1)\n"
+              << "  --extended        Parse/Bind/Execute/Sync instead of simple Query\n"
+              << "  --direct-port N   run a baseline against the backend first, then paired\n"
+              << "                    backend/proxy batches for the per-query added latency\n"
+              << "  --pid N           report CPU per query of this process (the proxy)\n";
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 3) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    LoadOptions options;
+    options.host = argv[1];
+    options.port = static_cast<uint16_t>(std::stoi(argv[2]));
+
+    for (int i = 3; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--conns" && i + 1 < argc) {
+            options.conns = std::stoul(argv[++i]);
+        } else if (arg == "--depth" && i + 1 < argc) {
+            options.depth = std::max(1ul, std::stoul(argv[++i]));
+        } else if (arg == "--duration" && i + 1 < argc) {
+            options.duration = std::stod(argv[++i]);
+        } else if (arg == "--warmup" && i + 1 < argc) {
+            options.warmup = std::stod(argv[++i]);
+        } else if (arg == "--extended") {
+            options.extended = true;
+        } else if (arg == "--direct-port" && i + 1 < argc) {
+            options.direct_port = static_cast<uint16_t>(std::stoi(argv[++i]));
+        } else if (arg == "--pid" && i + 1 < argc) {
+            options.proxy_pid = std::stoi(argv[++i]);
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    std::printf("mode=%s conns=%u depth=%u duration=%.1fs\n", options.extended ? "extended" : "simple",
+                options.conns, options.depth, options.duration);
+    std::printf("%-8s %12s %10s %10s %10s\n", "target", "qps", "p50_us", "p99_us", "p999_us");
+
+    PhaseResult direct;
+    if (options.direct_port) {
+        direct = run_phase(options, options.direct_port, 0);
+        print_row("direct", direct);
+    }
+
+    PhaseResult proxy = run_phase(options, options.port, options.proxy_pid);
+    print_row(options.direct_port ? "proxy" : "target", proxy);
+
+    if (proxy.cpu_us_per_query >= 0) {
+        std::printf("proxy cpu: %.2f us/query\n", proxy.cpu_us_per_query);
+    }
+
+    PhaseResult added;
+    if (options.direct_port) {
+        added = run_paired_phase(options);
+        std::printf("added    %12s %10.1f %10.1f %10.1f   (paired, proxy - direct per query)\n", "",
+                    added.p50, added.p99, added.p999);
+        if (added.failed) std::printf("         (%u paired connections failed)\n", added.failed);
+    }
+
+    return (direct.failed || proxy.failed || added.failed || proxy.queries == 0) ? 1 : 0;
+}
@@ -0,0 +1,138 @@
+#pragma once
+
+#include <arpa/inet.h>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <vector>
+
+//  Minimal PostgreSQL v3 wire helpers shared by the bench tools
+//  Blocking sockets only, nothing here is used by the proxy itself
+
+namespace pgwire {
+
+constexpr uint32_t kProtocolV3  = 196608;
+constexpr uint32_t kSslRequest  = 80877103;
+constexpr uint32_t kGssRequest  = 80877104;
+constexpr uint32_t kCancelCode  = 80877102;
+
+inline void putInt32(std::string& out, uint32_t v) {
+    v = htonl(v);
+    out.append(reinterpret_cast<const char*>(&v), 4);
+}
+
+inline void putInt16(std::string& out, uint16_t v) {
+    v = htons(v);
+    out.append(reinterpret_cast<const char*>(&v), 2);
+}
+
+inline uint32_t getInt32(const char* p) {
+    uint32_t v;
+    std::memcpy(&v, p, 4);
+    return ntohl(v);
+}
+
+//  Opens a typed message, returns where its length lives
+inline std::size_t begin(std::string& out, char type) {
+    out.push_back(type);
+    std::size_t pos = out.size();
+    out.append(4, '\0');
+    return pos;
+}
+
+//  Patch length once body is written
+inline void end(std::string& out, std::size_t pos) {
+    uint32_t len = htonl(static_cast<uint32_t>(out.size() - pos));
+    std::memcpy(&out[pos], &len, 4);
+}
+
+inline void message(std::string& out, char type, const std::string& body = std::string()) {
+    std::size_t pos = begin(out, type);
+    out += body;
+    end(out, pos);
+}
+
+inline bool sendAll(int fd, const char* data, std::size_t len) {
+    while (len > 0) {
+        ssize_t n = ::send(fd, data, len, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        data += n;
+        len -= static_cast<std::size_t>(n);
+    }
+    return true;
+}
+
+inline bool sendAll(int fd, const std::string& out) {
+    return sendAll(fd, out.data(), out.size());
+}
+
+//  Buffered message reader, one recv serves many pipelined messages
+class Reader {
+public:
+    explicit Reader(int fd) : fd_(fd), buf_(64 * 1024) {}
+
+    //  Untyped startup packet, body excludes length
+    bool startup(std::string& body) {
+        if (!fill(4)) return false;
+        uint32_t len = getInt32(&buf_[pos_]);
+        if (len < 8 || len > 10000) return false;
+        if (!fill(len)) return false;
+        body.assign(&buf_[pos_ + 4], len - 4);
+        pos_ += len;
+        return true;
+    }
+
+    //  Body points into the reader, valid until the next call
+    bool next(char& type, const char*& body, uint32_t& len) {
+        if (!fill(5)) return false;
+        uint32_t msg_len = getInt32(&buf_[pos_ + 1]);
+        if (msg_len < 4) return false;
+        if (!fill(1 + msg_len)) return false;
+
+        type = buf_[pos_];
+        body = &buf_[pos_ + 5];
+        len = msg_len - 4;
+        pos_ += 1 + msg_len;
+        return true;
+    }
+
+    //  Another complete message is already here, no recv needed
+    bool buffered() const {
+        if (end_ - pos_ < 5) return false;
+        return end_ - pos_ >= 1 + getInt32(&buf_[pos_ + 1]);
+    }
+
+private:
+    int fd_;
+    std::vector<char> buf_;
+    std::size_t pos_ = 0;
+    std::size_t end_ = 0;
+
+    bool fill(std::size_t need) {
+        if (end_ - pos_ >= need) return true;
+
+        //  Move the tail to the front, grow only for huge messages
+        if (pos_ > 0) {
+            std::memmove(buf_.data(), buf_.data() + pos_, end_ - pos_);
+            end_ -= pos_;
+            pos_ = 0;
+        }
+        if (buf_.size() < need) buf_.resize(need);
+
+        while (end_ < need) {
+            ssize_t n = ::recv(fd_, buf_.data() + end_, buf_.size() - end_, 0);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return false;
+            end_ += static_cast<std::size_t>(n);
+        }
+        return true;
+    }
+};
+
+}  // namespace pgwire
@@ -0,0 +1,168 @@
+#include "../src/TextScan.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+
+//  Micro-bench of the query rendering kernels, every cpu level it supports
+//  Each level is first checked byte for byte against the old per-byte loops,
+//  any mismatch exits non-zero before timing starts
+
+using Clock = std::chrono::steady_clock;
+
+//  Per-byte loops the parser used before, kept as reference
+
+static const char* refFindByte(const char* begin, const char* end, char c) {
+    for (const char* p = begin; p < end; p++) {
+        if (*p == c) return p;
+    }
+    return end;
+}
+
+static void refQuoteEscaped(std::string& out, std::string_view s) {
+    for (char c : s) {
+        if (c == '\'') out.push_back('\'');
+        out.push_back(c);
+    }
+}
+
+static void refHex(std::string& out, std::string_view s) {
+    static const char* hex = "0123456789abcdef";
+    for (unsigned char byte : s) {
+        out.push_back(hex[byte >> 4]);
+        out.push_back(hex[byte & 0x0F]);
+    }
+}
+
+//  Random bytes, quote_every = 0 means no quotes at all
+static std::string randomText(std::mt19937& rng, std::size_t len, unsigned quote_every) {
+    std::string s(len, '\0');
+    for (auto& c : s) {
+        c = static_cast<char>(rng() & 0xFF);
+        if (c == '\'' || c == '$') c = 'x';
+        if (quote_every && rng() % quote_every == 0) c = (rng() & 1) ? '\'' : '$';
+    }
+    return s;
+}
+
+static bool check(textscan::Level level) {
+    std::mt19937 rng(12345);
+    std::string scratch(512 + 64, '\0');
+
+    for (std::size_t len = 0; len <= 300; len++) {
+        for (unsigned quote_every : { 0u, 3u, 40u }) {
+            std::string text = randomText(rng, len, quote_every);
+
+            //  Every misalignment of the input start
+            for (std::size_t shift = 0; shift < 32; shift++) {
+                scratch.assign(shift, '#');
+                scratch += text;
+                std::string_view s(scratch.data() + shift, text.size());
+
+                for (char c : { '\'', '$' }) {
+                    if (textscan::findByte(s.data(), s.data() + s.size(), c) !=
+                        refFindByte(s.data(), s.data() + s.size(), c)) {
+                        std::fprintf(stderr, "%s findByte mismatch len=%zu shift=%zu\n",
+                                     textscan::levelName(level), len, shift);
+                        return false;
+                    }
+                }
+
+                std::string got = "prefix";
+                std::string want = "prefix";
+                textscan::appendQuoteEscaped(got, s);
+                refQuoteEscaped(want, s);
+                if (got != want) {
+                    std::fprintf(stderr, "%s appendQuoteEscaped mismatch len=%zu shift=%zu\n",
+                                 textscan::levelName(level), len, shift);
+                    return false;
+                }
+
+                got = want = "prefix";
+                textscan::appendHex(got, s);
+                refHex(want, s);
+                if (got != want) {
+                    std::fprintf(stderr, "%s appendHex mismatch len=%zu shift=%zu\n",
+                                 textscan::levelName(level), len, shift);
+                    return false;
+                }
+            }
+        }
+    }
+    return true;
+}
+
+//  MB/s of input processed
+template <typename Fn>
+static double throughput(const std::string& input, Fn fn) {
+    std::size_t bytes = 0;
+    auto start = Clock::now();
+    double seconds = 0;
+    do {
+        for (int i = 0; i < 64; i++) {
+            fn(input);
+            bytes += input.size();
+        }
+        seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    } while (seconds < 0.3);
+    return static_cast<double>(bytes) / seconds / 1e6;
+}
+
+static void bench(const char* name, const std::string& text, const std::string& quoted) {
+    std::string out;
+    out.reserve(4 * text.size());
+    volatile std::size_t sink = 0;
+
+    double find = throughput(text, [&](const std::string& s) {
+        sink = sink + static_cast<std::size_t>(textscan::findByte(s.data(), s.data() + s.size(), '$') - s.data());
+    });
+    double quote = throughput(quoted, [&](const std::string& s) { out.clear(); textscan::appendQuoteEscaped(out, s); });
+    double hex = throughput(text, [&](const std::string& s) { out.clear(); textscan::appendHex(out, s); });
+
+    std::printf("%-10s %12.0f %12.0f %12.0f\n", name, find, quote, hex);
+}
+
+int main(int argc, char* argv[]) {
+    std::size_t size = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 64 * 1024;
+
+    textscan::Level best = textscan::detected();
+    std::vector<textscan::Level> levels;
+    for (auto level : { textscan::Level::Scalar, textscan::Level::Sse42, textscan::Level::Avx2 }) {
+        if (static_cast<int>(level) <= static_cast<int>(best)) levels.push_back(level);
+    }
+
+    for (auto level : levels) {
+        textscan::force(level);
+        if (!check(level)) return 1;
+    }
+    std::printf("differential check ok, detected=%s\n", textscan::levelName(best));
+
+    std::mt19937 rng(42);
+    std::string text = randomText(rng, size, 0);
+    std::string quoted = randomText(rng, size, 200);  //  A quote every ~200 bytes
+
+    std::printf("input %zu bytes, MB/s of input\n", size);
+    std::printf("%-10s %12s %12s %12s\n", "level", "find $", "escape '", "hex");
+
+    //  Old per-byte loops for comparison
+    {
+        std::string out;
+        out.reserve(4 * size);
+        volatile std::size_t sink = 0;
+        double find = throughput(text, [&](const std::string& s) {
+            sink = sink + static_cast<std::size_t>(refFindByte(s.data(), s.data() + s.size(), '$') - s.data());
+        });
+        double quote = throughput(quoted, [&](const std::string& s) { out.clear(); refQuoteEscaped(out, s); });
+        double hex = throughput(text, [&](const std::string& s) { out.clear(); refHex(out, s); });
+        std::printf("%-10s %12.0f %12.0f %12.0f\n", "per-byte", find, quote, hex);
+    }
+
+    for (auto level : levels) {
+        textscan::force(level);
+        bench(textscan::levelName(level), text, quoted);
+    }
+    return 0;
+}
@@ -0,0 +1,70 @@
+#!/usr/bin/env bash
+
+# Loopback bench: fake backend <- proxy <- load generator, no PostgreSQL needed
+# Everything is tuned through env, e.g.
+#   CONNS=64 DEPTH=8 ROWS=100 MODE=extended PROXY_ARGS="--workers 2" make bench
+
+set -euo pipefail
+
+#  Defaults
+HOST="127.0.0.1"
+BACKEND_PORT="${BACKEND_PORT:-25432}"
+PROXY_PORT="${PROXY_PORT:-26432}"
+CONNS="${CONNS:-16}"
+DEPTH="${DEPTH:-1}"
+ROWS="${ROWS:-1}"
+ROW_SIZE="${ROW_SIZE:-16}"
+DURATION="${DURATION:-5}"
+MODE="${MODE:-simple}"
+PROXY_ARGS="${PROXY_ARGS:-}"
+
+ROOT="$(cd "$(dirname "$0")/.." && pwd)"
+BACKEND="${ROOT}/build/pg_fake_backend"
+LOADGEN="${ROOT}/build/pg_loadgen"
+PROXY="${ROOT}/pg_proxy"
+
+for exe in "${BACKEND}" "${LOADGEN}" "${PROXY}"; do
+  if [[ ! -x "${exe}" ]]; then
+    echo "Can't find executable, run make bench"
+    echo "  ${exe}"
+    exit 1
+  fi
+done
+
+#  Proxy writes logs/ into its cwd, keep them out of the tree
+RUN_DIR="$(mktemp -d)"
+PIDS=()
+
+cleanup() {
+  for pid in "${PIDS[@]}"; do
+    kill "${pid}" 2>/dev/null || true
+  done
+  wait 2>/dev/null || true
+  rm -rf "${RUN_DIR}"
+}
+trap cleanup EXIT
+
+"${BACKEND}" "${HOST}" "${BACKEND_PORT}" --rows "${ROWS}" --row-size "${ROW_SIZE}" >/dev/null &
+PIDS+=($!)
+
+# shellcheck disable=SC2086
+(cd "${RUN_DIR}" && exec "${PROXY}" "${HOST}" "${PROXY_PORT}" "${HOST}" "${BACKEND_PORT}" ${PROXY_ARGS}) \
+  >/dev/null 2>"${RUN_DIR}/proxy.err" &
+PROXY_PID=$!
+PIDS+=("${PROXY_PID}")
+
+sleep 0.5
+if ! kill -0 "${PROXY_PID}" 2>/dev/null; then
+  echo "Proxy failed to start:"
+  cat "${RUN_DIR}/proxy.err"
+  exit 1
+fi
+
+LOADGEN_ARGS=(--conns "${CONNS}" --depth "${DEPTH}" --duration "${DURATION}"
+              --direct-port "${BACKEND_PORT}" --pid "${PROXY_PID}")
+if [[ "${MODE}" == "extended" ]]; then
+  LOADGEN_ARGS+=(--extended)
+fi
+
+echo "rows=${ROWS} row_size=${ROW_SIZE} proxy_args='${PROXY_ARGS}'"
+"${LOADGEN}" "${HOST}" "${PROXY_PORT}" "${LOADGEN_ARGS[@]}"
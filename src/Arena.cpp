@@ -0,0 +1,56 @@
+#include "Arena.h"
+
+#include <algorithm>
+
+static std::size_t align_up(std::size_t value, std::size_t align) {
+    return (value + align - 1) & ~(align - 1);
+}
+
+void* Arena::allocate(std::size_t bytes, std::size_t align) {
+    //  Current chunk first, then kept chunks from earlier rounds
+    while (current_ < chunks_.size()) {
+        Chunk& chunk = chunks_[current_];
+        std::size_t start = align_up(offset_, align);
+        if (start + bytes <= chunk.size) {
+            offset_ = start + bytes;
+            used_ += bytes;
+            return chunk.data.get() + start;
+        }
+        current_++;
+        offset_ = 0;
+    }
+
+    //  Chunks double with arena size, so big binds take few mallocs
+    std::size_t size = std::max(chunk_size_, reserved_);
+    size = std::max(size, bytes);
+    chunks_.push_back(Chunk{ std::unique_ptr<char[]>(new char[size]), size });
+    reserved_ += size;
+    current_ = chunks_.size() - 1;
+
+    offset_ = bytes;
+    used_ += bytes;
+    return chunks_.back().data.get();
+}
+
+void Arena::reset() {
+    std::size_t kept = 0;
+    std::size_t n = 0;
+    while (n < chunks_.size() && kept + chunks_[n].size <= keep_bytes_) {
+        kept += chunks_[n].size;
+        n++;
+    }
+    chunks_.resize(n);
+
+    reserved_ = kept;
+    current_ = 0;
+    offset_ = 0;
+    used_ = 0;
+}
+
+void Arena::release() {
+    chunks_.clear();
+    reserved_ = 0;
+    current_ = 0;
+    offset_ = 0;
+    used_ = 0;
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstddef>
+#include <cstring>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+//  Bump allocator for parser state of one link
+//  Nothing is freed one by one: reset() rewinds everything at once,
+//  chunks up to keep_bytes stay allocated for the next round
+
+class Arena {
+public:
+    explicit Arena(std::size_t chunk_size = 4096, std::size_t keep_bytes = 64 * 1024)
+        : chunk_size_(chunk_size), keep_bytes_(keep_bytes) {}
+
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+    Arena(Arena&&) = default;
+    Arena& operator=(Arena&&) = default;
+
+    //  align up to alignof(max_align_t), chunk starts are malloc aligned
+    void* allocate(std::size_t bytes, std::size_t align = alignof(std::max_align_t));
+
+    template <typename T>
+    T* allocateArray(std::size_t count) {
+        return static_cast<T*>(allocate(count * sizeof(T), alignof(T)));
+    }
+
+    //  Copy lives until next reset()
+    std::string_view copy(std::string_view s) {
+        if (s.empty()) return std::string_view();
+        char* p = static_cast<char*>(allocate(s.size(), 1));
+        std::memcpy(p, s.data(), s.size());
+        return std::string_view(p, s.size());
+    }
+
+    //  Drop all allocations, extra chunks beyond keep_bytes go back to malloc
+    void reset();
+
+    //  Free everything
+    void release();
+
+    std::size_t reserved() const { return reserved_; }  //  Bytes taken from malloc
+    std::size_t used() const { return used_; }          //  Bytes handed out since reset
+
+private:
+    struct Chunk {
+        std::unique_ptr<char[]> data;
+        std::size_t size;
+    };
+
+    std::vector<Chunk> chunks_;
+    std::size_t current_ = 0;  //  Chunk being filled
+    std::size_t offset_ = 0;   //  Fill position in it
+    std::size_t reserved_ = 0;
+    std::size_t used_ = 0;
+    std::size_t chunk_size_;
+    std::size_t keep_bytes_;
+};
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+
+//  Global cap on bytes sitting in link buffers, shared by all workers
+//  Reactors charge on recv and refund on send/close, reads stop at the limit
+
+class BufferBudget {
+public:
+    explicit BufferBudget(std::size_t limit) : limit_(limit) {}
+
+    void charge(std::size_t bytes) { used_.fetch_add(bytes, std::memory_order_relaxed); }
+    void refund(std::size_t bytes) { used_.fetch_sub(bytes, std::memory_order_relaxed); }
+
+    //  How much one more read may take, 0 = over budget
+    std::size_t available() const {
+        std::size_t used = used_.load(std::memory_order_relaxed);
+        return used < limit_ ? limit_ - used : 0;
+    }
+
+    std::size_t used()  const { return used_.load(std::memory_order_relaxed); }
+    std::size_t limit() const { return limit_; }
+
+private:
+    const std::size_t limit_;
+    alignas(64) std::atomic<std::size_t> used_{0};
+};
@@ -1,27 +1,149 @@
 #pragma once
 
+#include <cstdint>
+#include <deque>
 #include <string>
+#include <unordered_map>
+#include <sys/socket.h>
+#include <sys/uio.h>
 
-struct Connection {
-    int id;
+#include "RingBuffer.h"
+
+//  Per-link data of an interceptor, owned and pooled by the interceptor
+//  Parked on the Connection so lookup is a pointer load, not a map search
+struct InterceptorState {
+    virtual ~InterceptorState() = default;
+};
+
+//  io_uring backend: one provided buffer waiting to be sent
+struct UringChunk {
+    std::uint16_t bid;
+    std::uint32_t len;
+};
+
+//  io_uring backend, one per socket of a link
+struct UringSide {
+    static constexpr unsigned kSendIov = 16;  //  Max chunks per sendmsg
+
+    std::deque<UringChunk> queue;  //  To this socket, first `sending` are in flight
+    std::size_t bytes = 0;         //  Sum of queue lengths
+    unsigned sending = 0;
+    std::size_t sending_bytes = 0;
+    iovec iov[kSendIov] = {};      //  In flight sendmsg, must outlive the sqe
+    msghdr msg = {};
+    bool recv_armed = false;
+    bool paused = false;           //  Recv stopped by backpressure or buffer shortage
+    bool send_retry = false;       //  Queued in uring_unsent_
+};
+
+struct Connection;
+
+//  Named statement of a pooled client, replayed on backends that lack it
+struct PooledStatement {
+    std::uint64_t hash = 0;  //  Of the whole Parse message, never 0
+    std::string parse;
+};
+
+//  Transaction pooling: a backend kept open by the proxy, lent to one client
+//  at a time, from its first message until ReadyForQuery says idle again
+struct ServerLink {
+    enum class State { Down, Connecting, Startup, Idle, Active };
+
+    int fd = -1;
+    State state = State::Down;
+    Connection* client = nullptr;
+
+    std::string in;             //  Server bytes not yet forwarded, a split header at most
+    std::size_t pass = 0;       //  Rest of a forwarded message body still to come
+    std::string out;            //  To the server, sent from out_off
+    std::size_t out_off = 0;
+    std::string params;         //  ParameterStatus messages of its startup
+
+    //  Statement name -> hash of its Parse message, 0 = exists, text unknown
+    std::unordered_map<std::string, std::uint64_t> prepared;
+
+    //  Parse ('1') and Close ('3') sent and not answered yet, in order
+    //  Injected ones are swallowed, the client never asked for them
+    struct Expect {
+        char reply;
+        bool swallow;
+        std::uint64_t sync;   //  Sync that ends its batch, skipped after an error
+        std::string name;
+        std::uint64_t hash;
+    };
+    std::deque<Expect> expect;
+    std::uint64_t syncs_sent = 0;  //  Q, Sync and FunctionCall, each answered by Z
+    std::uint64_t syncs_done = 0;
+    bool batch_open = false;       //  Extended messages sent after the last Sync
+};
+
+//  Pooled by Proxy: reclaimed after close, reused on accept
+//  16-byte aligned, io_uring user_data keeps an op code in low bits
+struct alignas(16) Connection {
+    int id = 0;
     int client_fd = -1;
     int server_fd = -1;
 
     std::string client_addr;
     std::string server_addr;
 
-    std::string client_out;
-    std::string server_out;
+    RingBuffer client_out;  //  server -> client bytes waiting for client socket
+    RingBuffer server_out;  //  client -> server bytes waiting for server socket
+
+    //  splice() pass-through server -> client, kernel pipe instead of client_out
+    int pipe_r = -1;
+    int pipe_w = -1;
+    std::size_t pipe_bytes = 0;
+    std::size_t pipe_capacity = 0;
+
+    //  Backpressure: EPOLLIN is off while peer's outbound data is over high mark
+    bool client_paused = false;
+    bool server_paused = false;
+    bool budget_wait = false;  //  Parked until global buffer budget frees
+
+    //  Edge-triggered mode: readiness seen and not yet consumed up to EAGAIN
+    bool client_readable = false;
+    bool server_readable = false;
+    bool client_writable = false;
+    bool server_writable = false;
+
+    //  io_uring backend
+    UringSide uring_client;
+    UringSide uring_server;
+    unsigned uring_ops = 0;  //  sqes in flight, link is reclaimed only at 0
+    bool server_connected = false;
+    bool cancel_retry = false;  //  Queued in uring_uncancelled_
+
+    //  Transaction pooling: server_fd stays -1, bytes go through link
+    enum class PoolPhase { Startup, Greeting, Ready, Closing };
+    PoolPhase pool_phase = PoolPhase::Startup;
+    ServerLink* link = nullptr;
+    bool pool_waiting = false;  //  Queued for an idle backend
+    std::string pool_in;        //  Client bytes not yet forwarded
+    //  Named statement -> its Parse message, replayed on whichever backend is lent
+    std::unordered_map<std::string, PooledStatement> prepared;
+
+    InterceptorState* interceptor_state = nullptr;
+
     bool closed = false;
 };
 
 enum class FdRole {
     LISTENER,
+    WAKEUP,
     CLIENT,
-    SERVER
+    SERVER,
+    POOL_SERVER,
+    WARM         //  Pre-warmed backend socket, not yet given to a link
 };
 
+//  Slot of the fd-indexed table, generation is bumped on every (un)register
+//  epoll events carry fd + generation, so events of a closed and reused fd are stale
 struct FdContext {
-    Connection* conn;
-    FdRole role;
+    Connection* conn = nullptr;
+    ServerLink* link = nullptr;  //  POOL_SERVER only
+    FdRole role = FdRole::LISTENER;
+    std::uint32_t gen = 0;
+    std::uint32_t events = 0;  //  Interest mask the kernel has now
+    bool in_use = false;
 };
@@ -0,0 +1,49 @@
+#include "Histogram.h"
+
+std::uint64_t LatencyHistogram::lowerBound(std::size_t index) {
+    constexpr std::size_t kSub = std::size_t(1) << kSubBits;
+    if (index < kSub) return index;
+
+    std::size_t group = index >> kSubBits;  //  >= 1, shift + 1
+    std::uint64_t sub = (index & (kSub - 1)) + kSub;
+    return sub << (group - 1);
+}
+
+std::uint64_t LatencyHistogram::upperBound(std::size_t index) {
+    constexpr std::size_t kSub = std::size_t(1) << kSubBits;
+    if (index < kSub) return index + 1;
+    return lowerBound(index) + (std::uint64_t(1) << ((index >> kSubBits) - 1));
+}
+
+void LatencyHistogram::addTo(Snapshot& out) const {
+    for (std::size_t i = 0; i < kBuckets; i++) {
+        out.counts[i] += counts_[i].load(std::memory_order_relaxed);
+    }
+    out.total += total_.load(std::memory_order_relaxed);
+    out.sum += sum_.load(std::memory_order_relaxed);
+}
+
+std::uint64_t LatencyHistogram::Snapshot::quantile(double q) const {
+    if (total == 0) return 0;
+
+    //  Bucket counts and total are read apart, so stop at the last bucket anyway
+    std::uint64_t rank = static_cast<std::uint64_t>(q * static_cast<double>(total) + 0.5);
+    if (rank == 0) rank = 1;
+    std::uint64_t seen = 0;
+    std::size_t last = 0;
+    for (std::size_t i = 0; i < kBuckets; i++) {
+        if (counts[i] == 0) continue;
+        last = i;
+        seen += counts[i];
+        if (seen >= rank) return upperBound(i);
+    }
+    return upperBound(last);
+}
+
+std::uint64_t LatencyHistogram::Snapshot::countAtOrBelow(std::uint64_t value) const {
+    std::uint64_t seen = 0;
+    for (std::size_t i = 0; i < kBuckets && upperBound(i) <= value + 1; i++) {
+        seen += counts[i];
+    }
+    return seen;
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+//  Log-linear buckets like HdrHistogram: 32 per power of two, ~3% value error
+//  One writer thread, any reader; counts are relaxed atomics, plain load/store to bump
+
+class LatencyHistogram {
+public:
+    static constexpr unsigned kSubBits = 5;
+    static constexpr unsigned kMaxBits = 40;  //  2^40 ns ~ 18 min, larger ones land in the last bucket
+    static constexpr std::size_t kBuckets = (kMaxBits - kSubBits + 2) << kSubBits;
+
+    //  Merged copy for reporting, plain integers
+    struct Snapshot {
+        std::array<std::uint64_t, kBuckets> counts{};
+        std::uint64_t total = 0;
+        std::uint64_t sum = 0;
+
+        //  Smallest value at or above the q-th fraction of samples, bucket upper bound
+        std::uint64_t quantile(double q) const;
+        //  Samples in buckets that end at or below value
+        std::uint64_t countAtOrBelow(std::uint64_t value) const;
+    };
+
+    void record(std::uint64_t value) {
+        bump(counts_[indexOf(value)], 1);
+        bump(total_, 1);
+        bump(sum_, value);
+    }
+
+    //  Adds this histogram into out, several workers merge into one
+    void addTo(Snapshot& out) const;
+
+    static std::size_t indexOf(std::uint64_t value);
+    static std::uint64_t lowerBound(std::size_t index);
+    static std::uint64_t upperBound(std::size_t index);  //  Exclusive
+
+private:
+    static void bump(std::atomic<std::uint64_t>& counter, std::uint64_t n) {
+        counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    std::array<std::atomic<std::uint64_t>, kBuckets> counts_{};
+    std::atomic<std::uint64_t> total_{0};
+    std::atomic<std::uint64_t> sum_{0};
+};
+
+inline std::size_t LatencyHistogram::indexOf(std::uint64_t value) {
+    constexpr std::uint64_t kSub = 1ull << kSubBits;
+    if (value < kSub) return static_cast<std::size_t>(value);
+
+    unsigned bits = 63 - static_cast<unsigned>(__builtin_clzll(value));
+    if (bits > kMaxBits) return kBuckets - 1;
+
+    unsigned shift = bits - kSubBits;
+    return (static_cast<std::size_t>(shift + 1) << kSubBits) + static_cast<std::size_t>((value >> shift) - kSub);
+}
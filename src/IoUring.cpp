@@ -0,0 +1,185 @@
+#include "IoUring.h"
+
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+//  Kernel and user space share ring indexes, access them as atomics
+static unsigned load_acquire(const unsigned* p) {
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+static void store_release(unsigned* p, unsigned v) {
+    __atomic_store_n(p, v, __ATOMIC_RELEASE);
+}
+
+IoUring::~IoUring() {
+    if (buf_base_) munmap(buf_base_, buf_total_);
+    if (sqes_) munmap(sqes_, sqes_map_size_);
+    if (cq_ptr_ && cq_ptr_ != sq_ptr_) munmap(cq_ptr_, cq_map_size_);
+    if (sq_ptr_) munmap(sq_ptr_, sq_map_size_);
+    if (ring_fd_ != -1) close(ring_fd_);
+}
+
+bool IoUring::init(unsigned entries) {
+    io_uring_params params{};
+    params.flags = IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_COOP_TASKRUN;
+
+    ring_fd_ = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+    if (ring_fd_ == -1 && errno == EINVAL) {
+        //  Older kernel, no hint flags
+        params = io_uring_params{};
+        ring_fd_ = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+    }
+    if (ring_fd_ == -1) return false;
+
+    //  FAST_POLL: recv/send on sockets park on poll, not on a worker thread
+    const unsigned required = IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP | IORING_FEAT_FAST_POLL;
+    if ((params.features & required) != required) return false;
+    cqe_skip_ = (params.features & IORING_FEAT_CQE_SKIP) != 0;
+
+    sq_map_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_map_size_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    if (cq_map_size_ > sq_map_size_) sq_map_size_ = cq_map_size_;
+
+    sq_ptr_ = mmap(nullptr, sq_map_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                   ring_fd_, IORING_OFF_SQ_RING);
+    if (sq_ptr_ == MAP_FAILED) {
+        sq_ptr_ = nullptr;
+        return false;
+    }
+    cq_ptr_ = sq_ptr_;  //  SINGLE_MMAP
+    cq_map_size_ = sq_map_size_;
+
+    sqes_map_size_ = params.sq_entries * sizeof(io_uring_sqe);
+    void* sqes = mmap(nullptr, sqes_map_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      ring_fd_, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) return false;
+    sqes_ = static_cast<io_uring_sqe*>(sqes);
+
+    char* sq = static_cast<char*>(sq_ptr_);
+    sq_head_    = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+    sq_tail_    = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+    sq_mask_    = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+    sq_entries_ = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_entries);
+    sq_array_   = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+    sqe_tail_   = *sq_tail_;
+
+    //  Identity mapping, sqe index == slot index
+    for (unsigned i = 0; i < sq_entries_; i++) {
+        sq_array_[i] = i;
+    }
+
+    char* cq = static_cast<char*>(cq_ptr_);
+    cq_head_ = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+    cq_tail_ = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+    cq_mask_ = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+    cqes_    = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+
+    return true;
+}
+
+int IoUring::enter(unsigned to_submit, unsigned min_complete, unsigned flags) {
+    while (true) {
+        int ret = static_cast<int>(syscall(__NR_io_uring_enter, ring_fd_, to_submit, min_complete,
+                                           flags, nullptr, 0));
+        if (ret >= 0 || errno != EINTR) return ret;
+    }
+}
+
+io_uring_sqe* IoUring::getSqe() {
+    unsigned head = load_acquire(sq_head_);
+    if (sqe_tail_ - head >= sq_entries_) {
+        //  SQ full: hand what we have to kernel
+        if (submitAndWait(0) < 0) return nullptr;
+        head = load_acquire(sq_head_);
+        if (sqe_tail_ - head >= sq_entries_) return nullptr;
+    }
+
+    io_uring_sqe* sqe = &sqes_[sqe_tail_ & sq_mask_];
+    sqe_tail_++;
+    std::memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+bool IoUring::reserve(unsigned n) {
+    if (n > sq_entries_) return false;
+    if (sqe_tail_ - load_acquire(sq_head_) + n <= sq_entries_) return true;
+
+    if (submitAndWait(0) < 0) return false;
+    return sqe_tail_ - load_acquire(sq_head_) + n <= sq_entries_;
+}
+
+int IoUring::submitAndWait(unsigned wait_nr) {
+    unsigned to_submit = sqe_tail_ - submitted_;
+    store_release(sq_tail_, sqe_tail_);
+    submitted_ = sqe_tail_;
+
+    if (to_submit == 0 && wait_nr == 0) return 0;
+
+    unsigned flags = wait_nr > 0 ? IORING_ENTER_GETEVENTS : 0;
+    return enter(to_submit, wait_nr, flags);
+}
+
+io_uring_cqe* IoUring::peekCqe() {
+    unsigned head = *cq_head_;
+    if (head == load_acquire(cq_tail_)) return nullptr;
+    return &cqes_[head & cq_mask_];
+}
+
+void IoUring::advance(unsigned count) {
+    store_release(cq_head_, *cq_head_ + count);
+}
+
+bool IoUring::provideBuffers(std::uint16_t group, unsigned count, std::size_t buf_size) {
+    buf_total_ = count * buf_size;
+    void* base = mmap(nullptr, buf_total_, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+    if (base == MAP_FAILED) return false;
+
+    buf_base_ = static_cast<char*>(base);
+    buf_size_ = buf_size;
+    buf_group_ = group;
+
+    //  All of them at once, wait for the answer
+    io_uring_sqe* sqe = getSqe();
+    if (!sqe) return false;
+    sqe->opcode = IORING_OP_PROVIDE_BUFFERS;
+    sqe->fd = static_cast<int>(count);
+    sqe->addr = reinterpret_cast<std::uint64_t>(buf_base_);
+    sqe->len = static_cast<std::uint32_t>(buf_size);
+    sqe->buf_group = group;
+
+    if (submitAndWait(1) < 0) return false;
+    io_uring_cqe* cqe = peekCqe();
+    if (!cqe) return false;
+    int res = cqe->res;
+    advance(1);
+    return res >= 0;
+}
+
+void IoUring::recycleBuffer(std::uint16_t bid) {
+    //  A lost bid is a buffer gone for good, keep it until an sqe frees up
+    io_uring_sqe* sqe = getSqe();
+    if (!sqe) {
+        unrecycled_.push_back(bid);
+        return;
+    }
+    sqe->opcode = IORING_OP_PROVIDE_BUFFERS;
+    sqe->fd = 1;
+    sqe->addr = reinterpret_cast<std::uint64_t>(buffer(bid));
+    sqe->len = static_cast<std::uint32_t>(buf_size_);
+    sqe->off = bid;
+    sqe->buf_group = buf_group_;
+    if (cqe_skip_) sqe->flags = IOSQE_CQE_SKIP_SUCCESS;
+}
+
+void IoUring::retryRecycles() {
+    std::vector<std::uint16_t> bids;
+    bids.swap(unrecycled_);
+    for (std::uint16_t bid : bids) {
+        recycleBuffer(bid);
+    }
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <linux/io_uring.h>
+#include <vector>
+
+//  Minimal io_uring wrapper over raw syscalls, no liburing needed
+//  One ring per reactor thread, never shared
+
+class IoUring {
+public:
+    IoUring() = default;
+    ~IoUring();
+
+    IoUring(const IoUring&) = delete;
+    IoUring& operator=(const IoUring&) = delete;
+
+    //  false if kernel has no usable io_uring (old kernel, seccomp, ...)
+    bool init(unsigned entries);
+
+    //  Zeroed sqe, flushes SQ to kernel when full, nullptr only on hard error
+    io_uring_sqe* getSqe();
+
+    //  Make room for n sqes in a row, so a linked chain is never split by a flush
+    bool reserve(unsigned n);
+
+    //  Submit queued sqes and wait for at least wait_nr completions
+    int submitAndWait(unsigned wait_nr);
+
+    //  Completions, call advance() after handling peeked ones
+    io_uring_cqe* peekCqe();
+    void advance(unsigned count);
+
+    //  Provided buffers: kernel picks one per recv, bid comes back in cqe flags
+    //  Uses IORING_OP_PROVIDE_BUFFERS, works on every kernel with multishot recv
+    bool provideBuffers(std::uint16_t group, unsigned count, std::size_t buf_size);
+    char* buffer(std::uint16_t bid) const { return buf_base_ + static_cast<std::size_t>(bid) * buf_size_; }
+    std::size_t bufferSize() const { return buf_size_; }
+
+    //  Back to kernel, cqe (user_data 0) only if it failed, or always before 5.17
+    //  No sqe: kept and handed back by retryRecycles()
+    void recycleBuffer(std::uint16_t bid);
+    void retryRecycles();
+    bool hasUnrecycled() const { return !unrecycled_.empty(); }
+
+    int fd() const { return ring_fd_; }
+
+private:
+    int ring_fd_ = -1;
+
+    //  SQ ring
+    void* sq_ptr_ = nullptr;
+    std::size_t sq_map_size_ = 0;
+    unsigned* sq_head_ = nullptr;
+    unsigned* sq_tail_ = nullptr;
+    unsigned* sq_array_ = nullptr;
+    unsigned sq_mask_ = 0;
+    unsigned sq_entries_ = 0;
+    io_uring_sqe* sqes_ = nullptr;
+    std::size_t sqes_map_size_ = 0;
+    unsigned sqe_tail_ = 0;     //  Local, published on submit
+    unsigned submitted_ = 0;
+
+    //  CQ ring
+    void* cq_ptr_ = nullptr;
+    std::size_t cq_map_size_ = 0;
+    unsigned* cq_head_ = nullptr;
+    unsigned* cq_tail_ = nullptr;
+    unsigned cq_mask_ = 0;
+    io_uring_cqe* cqes_ = nullptr;
+
+    //  Provided buffers
+    std::uint16_t buf_group_ = 0;
+    char* buf_base_ = nullptr;
+    std::size_t buf_size_ = 0;
+    std::size_t buf_total_ = 0;
+    std::vector<std::uint16_t> unrecycled_;
+    bool cqe_skip_ = false;     //  IOSQE_CQE_SKIP_SUCCESS usable
+
+    int enter(unsigned to_submit, unsigned min_complete, unsigned flags);
+};
@@ -1,11 +1,28 @@
 #include "Logger.h"
 
-Logger::Logger(const std::string& logFolder, const std::string& logName)
+#include <iostream>
+#include <vector>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#include "Profile.h"
+
+//  Records drained per writev, two slots of IOV_MAX reserved for stamps
+static constexpr std::size_t kBatchRecords = 512;
+
+Logger::Logger(const std::string& logFolder, const std::string& logName, const LoggerOptions& options)
     : logFolder_(logFolder)
     , logName_(logName)
     , maxBytes_(4ull * 1024ull * 1024ull)
     , maxFiles_(10)
-    , filesCounter_(1) {
+    , filesCounter_(1)
+    , options_(options) {
 
     if (maxFiles_ < 1) {
         maxFiles_ = 1;
@@ -17,36 +34,356 @@ Logger::Logger(const std::string& logFolder, const std::string& logName)
         throw std::runtime_error("Failed to create log directory: " + logFolder_ + " - " + ec.message());
     }
 
-    logStream_.open(make_log_path(filesCounter_), std::ios::out | std::ios::app);
-    
-    if (!logStream_.is_open()) {
-        throw std::runtime_error("Failed to open log");
+    open_current();
+
+    if (options_.async) {
+        ring_ = std::make_unique<MpscRing<Record>>(options_.queue_size);
+        writer_ = std::thread([this]() { writerLoop(); });
+    }
+}
+
+Logger::~Logger() {
+    if (writer_.joinable()) {
+        stopping_.store(true, std::memory_order_release);
+        {
+            std::lock_guard<std::mutex> lock(wakeMutex_);
+            wakeCv_.notify_one();
+        }
+        writer_.join();
+    }
+
+    if (dropped() || blocked()) {
+        std::cerr << "Logger: dropped=" << dropped() << " blocked=" << blocked() << "\n";
+    }
+
+    if (logFd_ != -1) {
+        close(logFd_);
+    }
+}
+
+void Logger::write(std::string_view message, Renderer render) {
+    PROFILE_SCOPE(kLogWrite);
+
+    if (ring_) {
+        enqueue(message, render);
+        return;
+    }
+
+    //  Outside the lock, other reactors keep writing meanwhile
+    thread_local std::string rendered;
+    if (render) {
+        rendered.clear();
+        render(message, rendered);
+        message = rendered;
     }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    if (check_oversize()) {
+        rotate();
+    }
+
+    std::string_view stamp = stamp_for(std::time(nullptr));
+    iovec iov[3];
+    iov[0] = { const_cast<char*>(stamp.data()), stamp.size() };
+    iov[1] = { const_cast<char*>(message.data()), message.size() };
+    iov[2] = { const_cast<char*>("\n"), 1 };
+    writeAll(iov, 3);
 }
 
-void Logger::write(std::string_view message) {
+void Logger::write(std::span<const std::string_view> messages, Renderer render) {
+    if (messages.empty()) return;
+    if (messages.size() == 1) {
+        write(messages[0], render);
+        return;
+    }
+
+    PROFILE_SCOPE(kLogWrite);
+
+    if (ring_) {
+        enqueueMany(messages, render);
+        return;
+    }
 
+    //  Lines are rendered outside the lock, '\n' included, then one writev
+    thread_local std::string rendered;
+    thread_local std::vector<std::size_t> ends;
+    rendered.clear();
+    ends.clear();
+    for (std::string_view message : messages) {
+        if (render) {
+            render(message, rendered);
+        } else {
+            rendered += message;
+        }
+        rendered += '\n';
+        ends.push_back(rendered.size());
+    }
+
+    thread_local std::vector<iovec> iov;
+    iov.resize(2 * ends.size());
+
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    //  Whole batch goes to one file, rotation waits for the next write
     if (check_oversize()) {
         rotate();
     }
 
-    logStream_ << "[" << current_timestamp() << "] " << message << '\n';
-    logStream_.flush();
+    std::string_view stamp = stamp_for(std::time(nullptr));
+    std::size_t start = 0;
+    for (std::size_t i = 0; i < ends.size(); i++) {
+        iov[2 * i] = { const_cast<char*>(stamp.data()), stamp.size() };
+        iov[2 * i + 1] = { rendered.data() + start, ends[i] - start };
+        start = ends[i];
+    }
+    writeAll(iov.data(), static_cast<int>(iov.size()));
+}
+
+//  Reactor side: one allocation for the copy, no syscalls
+void Logger::enqueue(std::string_view message, Renderer render) {
+    Record record;
+    record.time = std::time(nullptr);  //  vDSO, cheap
+    record.render = render;
+    record.text.reserve(message.size() + 1);
+    record.text.append(message);
+    if (!render) {
+        record.text.push_back('\n');
+    }
+    push(std::move(record), 1);
+}
+
+//  All lines in one record, one allocation and one slot for the batch
+void Logger::enqueueMany(std::span<const std::string_view> messages, Renderer render) {
+    std::size_t bytes = 0;
+    for (std::string_view message : messages) {
+        bytes += sizeof(std::uint32_t) + message.size();
+    }
+
+    Record record;
+    record.time = std::time(nullptr);
+    record.render = render;
+    record.framed = true;
+    record.text.reserve(bytes);
+    for (std::string_view message : messages) {
+        std::uint32_t len = static_cast<std::uint32_t>(message.size());
+        record.text.append(reinterpret_cast<const char*>(&len), sizeof(len));
+        record.text.append(message);
+    }
+    push(std::move(record), messages.size());
+}
+
+//  Full ring drops or waits, counted per line
+bool Logger::push(Record&& record, std::uint64_t lines) {
+    if (!ring_->tryPush(std::move(record))) {
+        if (!options_.block_when_full) {
+            dropped_.fetch_add(lines, std::memory_order_relaxed);
+            return false;
+        }
+
+        blocked_.fetch_add(1, std::memory_order_relaxed);
+        do {
+            {
+                std::lock_guard<std::mutex> lock(wakeMutex_);
+                wakeCv_.notify_one();
+            }
+            std::this_thread::yield();
+        } while (!ring_->tryPush(std::move(record)));
+    }
+
+    if (writerIdle_.load(std::memory_order_acquire)) {
+        std::lock_guard<std::mutex> lock(wakeMutex_);
+        wakeCv_.notify_one();
+    }
+    return true;
+}
+
+void Logger::writerLoop() {
+    std::vector<Record> batch(kBatchRecords);
+    std::uint64_t reportedDropped = 0;
+    std::uint64_t reportedBlocked = 0;
+    std::time_t lastReport = 0;
+
+    while (true) {
+        std::size_t count = 0;
+        while (count < kBatchRecords && ring_->tryPop(batch[count])) {
+            count++;
+        }
+        ring_->publishTail();
+
+        if (count > 0) {
+            renderBatch(batch.data(), count);
+            writeBatch(batch.data(), count);
+            for (std::size_t i = 0; i < count; i++) {
+                batch[i].text = std::string();  //  Release memory, ring may stay idle a while
+            }
+        }
+
+        //  Queue overflow report, at most once per second
+        std::time_t now = std::time(nullptr);
+        if (now != lastReport) {
+            std::uint64_t d = dropped();
+            std::uint64_t b = blocked();
+            if (d != reportedDropped || b != reportedBlocked) {
+                std::cerr << "Logger: queue full, dropped=" << d - reportedDropped
+                          << " blocked=" << b - reportedBlocked
+                          << " (total dropped=" << d << " blocked=" << b << ")\n";
+                reportedDropped = d;
+                reportedBlocked = b;
+            }
+            lastReport = now;
+        }
+
+        if (count == kBatchRecords) {
+            continue;  //  More is waiting, don't sleep
+        }
+
+        if (count == 0) {
+            if (stopping_.load(std::memory_order_acquire)) {
+                break;  //  Drained
+            }
+
+            //  Timed wait covers the race between idle flag and producer notify
+            writerIdle_.store(true, std::memory_order_release);
+            std::unique_lock<std::mutex> lock(wakeMutex_);
+            wakeCv_.wait_for(lock, std::chrono::milliseconds(10));
+            writerIdle_.store(false, std::memory_order_release);
+        }
+    }
+}
+
+//  Writer side: packed records become text, dropped ones never got here
+void Logger::renderBatch(Record* records, std::size_t count) {
+    std::string rendered;
+    for (std::size_t i = 0; i < count; i++) {
+        Record& rec = records[i];
+        if (rec.framed) {
+            rendered.clear();
+            renderFramed(rec, rendered);
+            rec.text.swap(rendered);
+            rec.render = nullptr;
+            rec.framed = false;
+            continue;
+        }
+        if (!rec.render) continue;
+
+        rendered.clear();
+        rec.render(rec.text, rendered);
+        rendered.push_back('\n');
+        rec.text.swap(rendered);  //  Packed buffer is reused for the next one
+        rec.render = nullptr;
+    }
+}
+
+//  Batch record becomes one text; writeBatch stamps its first line, the rest are stamped here
+void Logger::renderFramed(Record& rec, std::string& out) {
+    std::string stamp(stamp_for(rec.time));
+    std::string_view framed = rec.text;
+    bool first = true;
+    while (framed.size() >= sizeof(std::uint32_t)) {
+        std::uint32_t len;
+        std::memcpy(&len, framed.data(), sizeof(len));
+        framed.remove_prefix(sizeof(len));
+        std::string_view message = framed.substr(0, len);
+        framed.remove_prefix(message.size());
+
+        if (!first) out += stamp;
+        first = false;
+        if (rec.render) {
+            rec.render(message, out);
+        } else {
+            out += message;
+        }
+        out += '\n';
+    }
+}
+
+void Logger::writeBatch(Record* records, std::size_t count) {
+    iovec iov[2 * kBatchRecords];
+    int iovcnt = 0;
+
+    for (std::size_t i = 0; i < count; i++) {
+        Record& rec = records[i];
+
+        //  New second or full file: push what we have, stamp buffer gets reused
+        bool new_stamp = rec.time != cachedTime_;
+        if ((new_stamp || check_oversize()) && iovcnt > 0) {
+            writeAll(iov, iovcnt);
+            iovcnt = 0;
+        }
+
+        if (check_oversize()) {
+            rotate();
+        }
+
+        std::string_view stamp = stamp_for(rec.time);
+        iov[iovcnt++] = { const_cast<char*>(stamp.data()), stamp.size() };
+        iov[iovcnt++] = { rec.text.data(), rec.text.size() };
+        fileBytes_ += stamp.size() + rec.text.size();  //  Counted ahead, for rotation check
+    }
+
+    if (iovcnt > 0) {
+        writeAll(iov, iovcnt);
+    }
+}
+
+//  writev until everything is on disk, partial writes are resumed
+void Logger::writeAll(iovec* iov, int iovcnt) {
+    PROFILE_SCOPE(kLogFlush);
+
+    std::size_t expected = 0;
+    for (int i = 0; i < iovcnt; i++) {
+        expected += iov[i].iov_len;
+    }
+
+    bool counted = (ring_ != nullptr);  //  Async path counts in writeBatch
+    if (!counted) {
+        fileBytes_ += expected;
+    }
+
+    while (iovcnt > 0) {
+        ssize_t n = ::writev(logFd_, iov, std::min(iovcnt, IOV_MAX));
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror("log writev");
+            return;
+        }
+
+        std::size_t left = static_cast<std::size_t>(n);
+        while (iovcnt > 0 && left >= iov->iov_len) {
+            left -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = static_cast<char*>(iov->iov_base) + left;
+            iov->iov_len -= left;
+        }
+    }
+}
+
+void Logger::open_current() {
+    std::string path = make_log_path(filesCounter_);
+    logFd_ = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (logFd_ == -1) {
+        throw std::runtime_error("Failed to open log file: " + path);
+    }
+
+    //  Single stat per file, size is tracked in memory afterwards
+    struct stat st{};
+    fileBytes_ = (fstat(logFd_, &st) == 0) ? static_cast<std::uint64_t>(st.st_size) : 0;
 }
 
 void Logger::rotate() {
-    logStream_.close();
+    close(logFd_);
+    logFd_ = -1;
     filesCounter_++;
     delete_oldest_file();
-    std::string newPath = make_log_path(filesCounter_);
-    logStream_.open(newPath, std::ios::out | std::ios::app);
-    if (!logStream_.is_open()) {
-        throw std::runtime_error("Failed to open log file: " + newPath);
-    }
+    open_current();
 }
 
 void Logger::delete_oldest_file() {
-    //  delete the one file 
+    //  delete the one file
     if (maxFiles_ <= 1) {
         std::error_code err;
         std::filesystem::remove(make_log_path(filesCounter_), err);
@@ -60,25 +397,23 @@ void Logger::delete_oldest_file() {
     }
 }
 
-std::string Logger::current_timestamp() {
-    std::time_t time = std::time(nullptr);
-    std::tm tm;
-    localtime_r(&time, &tm);
-    char buf[32];
-    std::strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", &tm);
-    return std::string(buf);
+//  "[YYYY-mm-dd HH:MM:SS] ", formatted only when the second changes
+std::string_view Logger::stamp_for(std::time_t time) {
+    if (time != cachedTime_) {
+        std::tm tm;
+        localtime_r(&time, &tm);
+        cachedStamp_[0] = '[';
+        std::size_t n = std::strftime(cachedStamp_ + 1, sizeof(cachedStamp_) - 3, "%Y-%m-%d %H:%M:%S", &tm);
+        cachedStamp_[n + 1] = ']';
+        cachedStamp_[n + 2] = ' ';
+        cachedStampLen_ = n + 3;
+        cachedTime_ = time;
+    }
+    return std::string_view(cachedStamp_, cachedStampLen_);
 }
 
-bool Logger::check_oversize() {
-    std::error_code err;
-    std::string path = make_log_path(filesCounter_);
-    std::uint64_t size = std::filesystem::file_size(path, err);
-
-    if (err || size < maxBytes_) {
-        return false;
-    } else {
-        return true;
-    }
+bool Logger::check_oversize() const {
+    return fileBytes_ >= maxBytes_;
 }
 
 std::string Logger::make_log_path(uint16_t counter) {
@@ -87,4 +422,4 @@ std::string Logger::make_log_path(uint16_t counter) {
     } else {
         return logFolder_ + "/" + logName_ + "-" + std::to_string(counter) + ".log";
     }
-}
\ No newline at end of file
+}
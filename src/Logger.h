@@ -1,30 +1,101 @@
 #pragma once
 
-#include <fstream>
+#include <atomic>
+#include <condition_variable>
+#include <ctime>
 #include <string>
 #include <string_view>
 #include <filesystem>
 #include <chrono>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <thread>
+
+#include "MpscRing.h"
+
+struct LoggerOptions {
+    bool async = false;             //  Reactors enqueue, writer thread does the disk io
+    std::size_t queue_size = 65536; //  Ring slots, rounded up to power of 2
+    bool block_when_full = false;   //  Full ring: wait for writer instead of dropping
+};
 
 class Logger {
-    
+
 public:
-    explicit Logger(const std::string& logFolder_, const std::string& logName);
-    void write(std::string_view message);
+    explicit Logger(const std::string& logFolder_, const std::string& logName,
+                    const LoggerOptions& options = LoggerOptions());
+    ~Logger();
+
+    Logger(const Logger&) = delete;
+    Logger& operator=(const Logger&) = delete;
+
+    //  Turns a packed message into log text, runs on whichever thread writes it
+    using Renderer = void (*)(std::string_view packed, std::string& out);
+
+    //  With render set, message is packed and rendered late:
+    //  async mode on the writer thread, sync mode before taking the file lock
+    void write(std::string_view message, Renderer render = nullptr);
+
+    //  Many lines at once: sync mode takes the lock and writes once,
+    //  async mode takes one ring slot for all of them
+    void write(std::span<const std::string_view> messages, Renderer render = nullptr);
+
+    //  Async mode stats
+    std::uint64_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+    std::uint64_t blocked() const { return blocked_.load(std::memory_order_relaxed); }
+    std::size_t queueDepth() const { return ring_ ? ring_->sizeApprox() : 0; }
 
 private:
+    struct Record {
+        std::time_t time = 0;
+        std::string text;
+        Renderer render = nullptr;  //  text is packed until writer renders it
+        bool framed = false;        //  text is | u32 len | message | per line, writer splits it
+    };
+
     std::string logFolder_;
     std::string logName_;
     std::uint64_t maxBytes_;
     std::uint16_t maxFiles_;
     std::uint16_t filesCounter_;
+    LoggerOptions options_;
+
+    //  Size is tracked here, no stat() per record
+    int logFd_ = -1;
+    std::uint64_t fileBytes_ = 0;
+
+    //  Sync mode: shared by all reactor threads
+    std::mutex mutex_;
+
+    //  Async mode
+    std::unique_ptr<MpscRing<Record>> ring_;
+    std::thread writer_;
+    std::atomic<bool> stopping_{false};
+    std::atomic<bool> writerIdle_{false};
+    std::mutex wakeMutex_;
+    std::condition_variable wakeCv_;
+    std::atomic<std::uint64_t> dropped_{0};
+    std::atomic<std::uint64_t> blocked_{0};
+
+    //  Timestamp cache, strftime once per second
+    std::time_t cachedTime_ = -1;
+    char cachedStamp_[32];
+    std::size_t cachedStampLen_ = 0;
 
+    void enqueue(std::string_view message, Renderer render);
+    void enqueueMany(std::span<const std::string_view> messages, Renderer render);
+    bool push(Record&& record, std::uint64_t lines);
+    void renderFramed(Record& rec, std::string& out);
+    void renderBatch(Record* records, std::size_t count);
+    void writerLoop();
+    void writeBatch(Record* records, std::size_t count);
+    void writeAll(struct iovec* iov, int iovcnt);
 
-    std::ofstream logStream_;
-    std::ofstream queryStream_;
-    bool check_oversize();
+    void open_current();
+    bool check_oversize() const;
     void rotate();
     void delete_oldest_file();
     std::string make_log_path(uint16_t counter);
-    std::string current_timestamp();
+    std::string_view stamp_for(std::time_t time);
 };
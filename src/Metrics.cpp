@@ -0,0 +1,271 @@
+#include "Metrics.h"
+
+#include <cerrno>
+#include <charconv>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace {
+
+//  Fixed le bounds, same set every scrape so rate() over buckets works
+constexpr std::uint64_t kBucketBoundsNs[] = {
+    1000, 2000, 5000, 10000, 20000, 50000, 100000, 200000, 500000,
+    1000000, 2000000, 5000000, 10000000, 20000000, 50000000,
+    100000000, 200000000, 500000000, 1000000000,
+};
+
+constexpr double kQuantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+
+void appendHeader(std::string& out, const std::string& name, const char* type, const char* help) {
+    out += "# HELP ";
+    out += name;
+    out += ' ';
+    out += help;
+    out += "\n# TYPE ";
+    out += name;
+    out += ' ';
+    out += type;
+    out += '\n';
+}
+
+void appendSample(std::string& out, const std::string& name, const std::string& labels, double value) {
+    char num[32];
+    int n = std::snprintf(num, sizeof(num), "%.9g", value);
+    out += name;
+    if (!labels.empty()) {
+        out += '{';
+        out += labels;
+        out += '}';
+    }
+    out += ' ';
+    out.append(num, static_cast<std::size_t>(n));
+    out += '\n';
+}
+
+double load(const std::atomic<std::uint64_t>& counter) {
+    return static_cast<double>(counter.load(std::memory_order_relaxed));
+}
+
+}  // namespace
+
+WorkerMetrics* Metrics::addWorker() {
+    workers_.push_back(std::make_unique<WorkerMetrics>());
+    return workers_.back().get();
+}
+
+void Metrics::addValue(std::string name, std::string type, std::string help, std::function<double()> read) {
+    values_.push_back(Value{ std::move(name), std::move(type), std::move(help), std::move(read) });
+}
+
+void Metrics::appendHistogram(std::string& out, const std::string& name, const std::string& labels,
+                              const LatencyHistogram::Snapshot& snapshot) {
+    std::string prefix = labels.empty() ? std::string() : labels + ",";
+    char le[32];
+    for (std::uint64_t bound : kBucketBoundsNs) {
+        std::snprintf(le, sizeof(le), "le=\"%.9g\"", static_cast<double>(bound) / 1e9);
+        appendSample(out, name + "_bucket", prefix + le, static_cast<double>(snapshot.countAtOrBelow(bound)));
+    }
+    appendSample(out, name + "_bucket", prefix + "le=\"+Inf\"", static_cast<double>(snapshot.total));
+    appendSample(out, name + "_sum", labels, static_cast<double>(snapshot.sum) / 1e9);
+    appendSample(out, name + "_count", labels, static_cast<double>(snapshot.total));
+}
+
+void Metrics::render(std::string& out) const {
+    auto perWorker = [&](const char* name, const char* type, const char* help, auto value) {
+        appendHeader(out, name, type, help);
+        for (std::size_t i = 0; i < workers_.size(); i++) {
+            appendSample(out, name, "worker=\"" + std::to_string(i) + "\"", value(*workers_[i]));
+        }
+    };
+
+    perWorker("pg_proxy_connections_active", "gauge", "Links open now",
+              [](const WorkerMetrics& w) { return load(w.accepted) - load(w.closed); });
+    perWorker("pg_proxy_connections_total", "counter", "Links accepted",
+              [](const WorkerMetrics& w) { return load(w.accepted); });
+
+    appendHeader(out, "pg_proxy_bytes_total", "counter", "Bytes received per direction");
+    for (std::size_t i = 0; i < workers_.size(); i++) {
+        std::string worker = "worker=\"" + std::to_string(i) + "\"";
+        appendSample(out, "pg_proxy_bytes_total", worker + ",direction=\"client_to_server\"", load(workers_[i]->bytes_c2s));
+        appendSample(out, "pg_proxy_bytes_total", worker + ",direction=\"server_to_client\"", load(workers_[i]->bytes_s2c));
+    }
+
+    appendHeader(out, "pg_proxy_backend_connects_total", "counter", "Backend sockets given to accepted links");
+    for (std::size_t i = 0; i < workers_.size(); i++) {
+        std::string worker = "worker=\"" + std::to_string(i) + "\"";
+        appendSample(out, "pg_proxy_backend_connects_total", worker + ",kind=\"warm\"", load(workers_[i]->connects_warm));
+        appendSample(out, "pg_proxy_backend_connects_total", worker + ",kind=\"cold\"", load(workers_[i]->connects_cold));
+    }
+
+    static const char* const kTypes[WorkerMetrics::kMessageTypes] = { "Q", "P", "B", "E" };
+    appendHeader(out, "pg_proxy_messages_total", "counter", "Client protocol messages by type");
+    for (std::size_t i = 0; i < workers_.size(); i++) {
+        for (int t = 0; t < WorkerMetrics::kMessageTypes; t++) {
+            appendSample(out, "pg_proxy_messages_total",
+                         "worker=\"" + std::to_string(i) + "\",type=\"" + kTypes[t] + "\"",
+                         load(workers_[i]->messages[t]));
+        }
+    }
+
+    //  Loop time: bucketed for Prometheus, exact-ish quantiles straight from the HDR buckets
+    std::vector<LatencyHistogram::Snapshot> loops(workers_.size());
+    for (std::size_t i = 0; i < workers_.size(); i++) {
+        workers_[i]->loop_ns.addTo(loops[i]);
+    }
+
+    appendHeader(out, "pg_proxy_loop_seconds", "histogram", "Busy time of one event loop iteration");
+    for (std::size_t i = 0; i < loops.size(); i++) {
+        appendHistogram(out, "pg_proxy_loop_seconds", "worker=\"" + std::to_string(i) + "\"", loops[i]);
+    }
+
+    appendHeader(out, "pg_proxy_loop_quantile_seconds", "gauge", "Event loop iteration time quantiles since start");
+    for (std::size_t i = 0; i < loops.size(); i++) {
+        for (double q : kQuantiles) {
+            char label[64];
+            std::snprintf(label, sizeof(label), "worker=\"%zu\",quantile=\"%g\"", i, q);
+            appendSample(out, "pg_proxy_loop_quantile_seconds", label, static_cast<double>(loops[i].quantile(q)) / 1e9);
+        }
+    }
+
+    for (const Value& value : values_) {
+        appendHeader(out, value.name, value.type.c_str(), value.help.c_str());
+        appendSample(out, value.name, std::string(), value.read());
+    }
+}
+
+MetricsServer::MetricsServer(const Metrics& metrics, std::string address)
+    : metrics_(metrics)
+    , address_(std::move(address)) {}
+
+MetricsServer::~MetricsServer() {
+    stop();
+}
+
+bool MetricsServer::start() {
+    if (address_.rfind("unix:", 0) == 0) {
+        unix_path_ = address_.substr(5);
+        sockaddr_un addr{};
+        if (unix_path_.empty() || unix_path_.size() >= sizeof(addr.sun_path)) {
+            std::cerr << "Metrics: bad unix socket path " << unix_path_ << "\n";
+            return false;
+        }
+        addr.sun_family = AF_UNIX;
+        std::memcpy(addr.sun_path, unix_path_.c_str(), unix_path_.size() + 1);
+
+        listen_fd_ = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (listen_fd_ == -1) {
+            perror("metrics socket");
+            return false;
+        }
+        ::unlink(unix_path_.c_str());  //  Left by a previous run
+        if (::bind(listen_fd_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == -1) {
+            perror("metrics bind");
+            return false;
+        }
+    } else {
+        std::size_t colon = address_.rfind(':');
+        if (colon == std::string::npos) {
+            std::cerr << "Metrics: address must be host:port or unix:/path\n";
+            return false;
+        }
+        std::string port_text = address_.substr(colon + 1);
+        unsigned port = 0;
+        auto [end, ec] = std::from_chars(port_text.data(), port_text.data() + port_text.size(), port);
+        if (ec != std::errc() || end != port_text.data() + port_text.size() || port < 1 || port > 65535) {
+            std::cerr << "Metrics: bad port " << port_text << "\n";
+            return false;
+        }
+
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(static_cast<uint16_t>(port));
+        if (inet_pton(AF_INET, address_.substr(0, colon).c_str(), &addr.sin_addr) <= 0) {
+            std::cerr << "Metrics: bad host " << address_.substr(0, colon) << "\n";
+            return false;
+        }
+
+        listen_fd_ = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (listen_fd_ == -1) {
+            perror("metrics socket");
+            return false;
+        }
+        int one = 1;
+        setsockopt(listen_fd_, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        if (::bind(listen_fd_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == -1) {
+            perror("metrics bind");
+            return false;
+        }
+    }
+
+    if (::listen(listen_fd_, 16) == -1) {
+        perror("metrics listen");
+        return false;
+    }
+
+    thread_ = std::thread([this]() { serve(); });
+    return true;
+}
+
+void MetricsServer::stop() {
+    stopping_.store(true, std::memory_order_relaxed);
+    if (thread_.joinable()) thread_.join();
+
+    if (listen_fd_ != -1) {
+        close(listen_fd_);
+        listen_fd_ = -1;
+        if (!unix_path_.empty()) ::unlink(unix_path_.c_str());
+    }
+}
+
+//  Poll with a timeout, so stop() is noticed without poking the socket
+void MetricsServer::serve() {
+    while (!stopping_.load(std::memory_order_relaxed)) {
+        pollfd pfd{ listen_fd_, POLLIN, 0 };
+        int n = ::poll(&pfd, 1, 200);
+        if (n <= 0) continue;
+
+        int fd = ::accept4(listen_fd_, nullptr, nullptr, SOCK_CLOEXEC);
+        if (fd == -1) continue;
+
+        //  Slow or silent scraper can hold us for a second at most
+        timeval timeout{ 1, 0 };
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        answer(fd);
+        close(fd);
+    }
+}
+
+void MetricsServer::answer(int fd) {
+    //  Request is not looked at beyond its end, any path gets the metrics
+    std::string request;
+    char buf[1024];
+    while (request.find("\r\n\r\n") == std::string::npos && request.size() < 8192) {
+        ssize_t n = ::recv(fd, buf, sizeof(buf), 0);
+        if (n <= 0) break;
+        request.append(buf, static_cast<std::size_t>(n));
+    }
+
+    std::string body;
+    metrics_.render(body);
+
+    std::string response = "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: "
+                         + std::to_string(body.size()) + "\r\nConnection: close\r\n\r\n" + body;
+
+    std::size_t sent = 0;
+    while (sent < response.size()) {
+        ssize_t n = ::send(fd, response.data() + sent, response.size() - sent, MSG_NOSIGNAL);
+        if (n <= 0) {
+            if (n == -1 && errno == EINTR) continue;
+            return;
+        }
+        sent += static_cast<std::size_t>(n);
+    }
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Histogram.h"
+
+//  Counters of one reactor thread, written by it alone, read by the exporter
+//  Own cache lines, so workers never share a line with each other
+struct alignas(64) WorkerMetrics {
+    enum MessageType { kQuery, kParse, kBind, kExecute, kMessageTypes };
+
+    std::atomic<std::uint64_t> accepted{0};
+    std::atomic<std::uint64_t> closed{0};
+    std::atomic<std::uint64_t> bytes_c2s{0};
+    std::atomic<std::uint64_t> bytes_s2c{0};
+    std::atomic<std::uint64_t> messages[kMessageTypes] = {};
+    std::atomic<std::uint64_t> connects_warm{0};  //  Accepts paired with a pre-warmed backend socket
+    std::atomic<std::uint64_t> connects_cold{0};  //  Accepts that started a connect() of their own, epoll only
+
+    alignas(64) LatencyHistogram loop_ns;  //  Busy part of one event loop iteration
+
+    //  Single writer: plain load/store, no locked add
+    static void add(std::atomic<std::uint64_t>& counter, std::uint64_t n = 1) {
+        counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    //  Monotonic ns, vDSO call
+    static std::uint64_t now() {
+        timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return static_cast<std::uint64_t>(ts.tv_sec) * 1000000000ull + static_cast<std::uint64_t>(ts.tv_nsec);
+    }
+};
+
+//  Registry rendered in Prometheus text format
+//  Slots and values are registered before workers start, read from any thread later
+
+class Metrics {
+public:
+    WorkerMetrics* addWorker();
+
+    //  Process-wide value sampled at render time, type is "gauge" or "counter"
+    void addValue(std::string name, std::string type, std::string help, std::function<double()> read);
+
+    void render(std::string& out) const;
+
+private:
+    struct Value {
+        std::string name;
+        std::string type;
+        std::string help;
+        std::function<double()> read;
+    };
+
+    std::vector<std::unique_ptr<WorkerMetrics>> workers_;
+    std::vector<Value> values_;
+
+    static void appendHistogram(std::string& out, const std::string& name, const std::string& labels,
+                                const LatencyHistogram::Snapshot& snapshot);
+};
+
+//  GET of anything returns the metrics, one request per connection
+//  Own thread with blocking sockets, never touches a reactor
+
+class MetricsServer {
+public:
+    //  "host:port" for TCP, "unix:/path" for a Unix socket
+    MetricsServer(const Metrics& metrics, std::string address);
+    ~MetricsServer();
+
+    MetricsServer(const MetricsServer&) = delete;
+    MetricsServer& operator=(const MetricsServer&) = delete;
+
+    bool start();
+    void stop();
+
+private:
+    const Metrics& metrics_;
+    std::string address_;
+    std::string unix_path_;
+    int listen_fd_ = -1;
+    std::atomic<bool> stopping_{false};
+    std::thread thread_;
+
+    void serve();
+    void answer(int fd);
+};
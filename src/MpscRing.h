@@ -0,0 +1,95 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <utility>
+
+//  Bounded lock-free queue, many producers, one consumer
+//  Every cell carries a sequence number (Vyukov scheme):
+//    seq == pos          -> cell is free for producer claiming pos
+//    seq == pos + 1      -> cell is filled, consumer may take it
+//  Producers race only on head_ with CAS, consumer owns tail_ alone
+
+template <typename T>
+class MpscRing {
+public:
+    explicit MpscRing(std::size_t capacity) {
+        std::size_t size = 2;
+        while (size < capacity) {
+            size <<= 1;  //  Power of 2, so index is a mask, not a division
+        }
+
+        mask_ = size - 1;
+        cells_ = std::make_unique<Cell[]>(size);
+        for (std::size_t i = 0; i < size; i++) {
+            cells_[i].seq.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    //  Producer side, false when ring is full
+    bool tryPush(T&& value) {
+        std::size_t pos = head_.load(std::memory_order_relaxed);
+
+        while (true) {
+            Cell& cell = cells_[pos & mask_];
+            std::size_t seq = cell.seq.load(std::memory_order_acquire);
+            auto diff = static_cast<std::ptrdiff_t>(seq) - static_cast<std::ptrdiff_t>(pos);
+
+            if (diff == 0) {
+                if (head_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    cell.value = std::move(value);
+                    cell.seq.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false;  //  Consumer did not free this cell yet
+            } else {
+                pos = head_.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    //  Consumer side, only one thread may call it
+    bool tryPop(T& out) {
+        Cell& cell = cells_[tail_ & mask_];
+        std::size_t seq = cell.seq.load(std::memory_order_acquire);
+
+        if (static_cast<std::ptrdiff_t>(seq) - static_cast<std::ptrdiff_t>(tail_ + 1) < 0) {
+            return false;  //  Empty, or producer is still writing
+        }
+
+        out = std::move(cell.value);
+        cell.seq.store(tail_ + mask_ + 1, std::memory_order_release);
+        tail_++;
+        return true;
+    }
+
+    //  Racy by nature, good enough for stats
+    std::size_t sizeApprox() const {
+        std::size_t head = head_.load(std::memory_order_relaxed);
+        std::size_t tail = tail_shadow_.load(std::memory_order_relaxed);
+        return head > tail ? head - tail : 0;
+    }
+
+    //  Consumer publishes its position for sizeApprox()
+    void publishTail() {
+        tail_shadow_.store(tail_, std::memory_order_relaxed);
+    }
+
+    std::size_t capacity() const { return mask_ + 1; }
+
+private:
+    struct Cell {
+        std::atomic<std::size_t> seq;
+        T value;
+    };
+
+    std::unique_ptr<Cell[]> cells_;
+    std::size_t mask_ = 0;
+
+    //  Separate cache lines, producers and consumer should not fight
+    alignas(64) std::atomic<std::size_t> head_{0};
+    alignas(64) std::size_t tail_ = 0;
+    std::atomic<std::size_t> tail_shadow_{0};
+};
@@ -0,0 +1,322 @@
+#include "PgBinary.h"
+
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <cstring>
+
+#include "TextScan.h"
+
+namespace pgbinary {
+
+//  Network order readers, length is checked by caller
+
+static std::uint16_t be16(const char* p) {
+    const unsigned char* b = reinterpret_cast<const unsigned char*>(p);
+    return static_cast<std::uint16_t>((b[0] << 8) | b[1]);
+}
+
+static std::uint32_t be32(const char* p) {
+    const unsigned char* b = reinterpret_cast<const unsigned char*>(p);
+    return (std::uint32_t(b[0]) << 24) | (std::uint32_t(b[1]) << 16) |
+           (std::uint32_t(b[2]) << 8)  |  std::uint32_t(b[3]);
+}
+
+static std::uint64_t be64(const char* p) {
+    return (std::uint64_t(be32(p)) << 32) | be32(p + 4);
+}
+
+template <typename T>
+static void appendNumber(std::string& out, T value) {
+    char buf[32];
+    auto res = std::to_chars(buf, buf + sizeof(buf), value);
+    out.append(buf, static_cast<std::size_t>(res.ptr - buf));
+}
+
+//  Fixed width, zero padded
+static void appendPadded(std::string& out, std::int64_t value, int width) {
+    char buf[24];
+    auto res = std::to_chars(buf, buf + sizeof(buf), value);
+    int len = static_cast<int>(res.ptr - buf);
+    if (len < width) out.append(static_cast<std::size_t>(width - len), '0');
+    out.append(buf, static_cast<std::size_t>(len));
+}
+
+static bool appendBool(std::string& out, std::string_view v) {
+    if (v.size() != 1) return false;
+    out += v[0] ? "true" : "false";
+    return true;
+}
+
+static bool appendInt2(std::string& out, std::string_view v) {
+    if (v.size() != 2) return false;
+    appendNumber(out, static_cast<std::int16_t>(be16(v.data())));
+    return true;
+}
+
+static bool appendInt4(std::string& out, std::string_view v) {
+    if (v.size() != 4) return false;
+    appendNumber(out, static_cast<std::int32_t>(be32(v.data())));
+    return true;
+}
+
+static bool appendOid(std::string& out, std::string_view v) {
+    if (v.size() != 4) return false;
+    appendNumber(out, be32(v.data()));
+    return true;
+}
+
+static bool appendInt8(std::string& out, std::string_view v) {
+    if (v.size() != 8) return false;
+    appendNumber(out, static_cast<std::int64_t>(be64(v.data())));
+    return true;
+}
+
+//  Shortest round-trip form, specials need quotes and a cast
+template <typename T>
+static void appendFloat(std::string& out, T value, const char* cast) {
+    if (std::isnan(value)) {
+        out += "'NaN'";
+    } else if (std::isinf(value)) {
+        out += value > 0 ? "'Infinity'" : "'-Infinity'";
+    } else {
+        appendNumber(out, value);
+        return;
+    }
+    out += cast;
+}
+
+static bool appendFloat4(std::string& out, std::string_view v) {
+    if (v.size() != 4) return false;
+    std::uint32_t bits = be32(v.data());
+    float value;
+    std::memcpy(&value, &bits, sizeof(value));
+    appendFloat(out, value, "::float4");
+    return true;
+}
+
+static bool appendFloat8(std::string& out, std::string_view v) {
+    if (v.size() != 8) return false;
+    std::uint64_t bits = be64(v.data());
+    double value;
+    std::memcpy(&value, &bits, sizeof(value));
+    appendFloat(out, value, "::float8");
+    return true;
+}
+
+//  Binary text types are the raw string
+static bool appendText(std::string& out, std::string_view v) {
+    out.push_back('\'');
+    textscan::appendQuoteEscaped(out, v);
+    out.push_back('\'');
+    return true;
+}
+
+static bool appendUuid(std::string& out, std::string_view v) {
+    if (v.size() != 16) return false;
+    out.push_back('\'');
+    for (std::size_t i = 0; i < 16; i++) {
+        if (i == 4 || i == 6 || i == 8 || i == 10) out.push_back('-');
+        textscan::appendHex(out, v.substr(i, 1));
+    }
+    out.push_back('\'');
+    return true;
+}
+
+//  Days since 1970-01-01 -> civil date (H. Hinnant's algorithm)
+static void civilFromDays(std::int64_t z, std::int64_t& y, unsigned& m, unsigned& d) {
+    z += 719468;
+    const std::int64_t era = (z >= 0 ? z : z - 146096) / 146097;
+    const unsigned doe = static_cast<unsigned>(z - era * 146097);
+    const unsigned yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    const unsigned doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    const unsigned mp = (5 * doy + 2) / 153;
+    d = doy - (153 * mp + 2) / 5 + 1;
+    m = mp < 10 ? mp + 3 : mp - 9;
+    y = static_cast<std::int64_t>(yoe) + era * 400 + (m <= 2);
+}
+
+//  Postgres epoch is 2000-01-01
+static constexpr std::int64_t kPgEpochDays = 10957;
+
+//  YYYY-MM-DD, true if year is BC, caller puts " BC" at the very end
+static bool appendDate(std::string& out, std::int64_t days_since_pg_epoch) {
+    std::int64_t y;
+    unsigned m, d;
+    civilFromDays(days_since_pg_epoch + kPgEpochDays, y, m, d);
+
+    bool bc = y <= 0;
+    appendPadded(out, bc ? 1 - y : y, 4);
+    out.push_back('-');
+    appendPadded(out, m, 2);
+    out.push_back('-');
+    appendPadded(out, d, 2);
+    return bc;
+}
+
+static bool appendDateValue(std::string& out, std::string_view v) {
+    if (v.size() != 4) return false;
+    std::int32_t days = static_cast<std::int32_t>(be32(v.data()));
+    if (days == INT32_MAX) { out += "'infinity'::date"; return true; }
+    if (days == INT32_MIN) { out += "'-infinity'::date"; return true; }
+
+    out.push_back('\'');
+    if (appendDate(out, days)) out += " BC";
+    out += "'::date";
+    return true;
+}
+
+//  int64 microseconds since 2000-01-01 00:00:00
+static bool appendTimestampValue(std::string& out, std::string_view v, bool with_tz) {
+    if (v.size() != 8) return false;
+    const char* cast = with_tz ? "::timestamptz" : "::timestamp";
+
+    std::int64_t usec = static_cast<std::int64_t>(be64(v.data()));
+    if (usec == INT64_MAX) { out += "'infinity'"; out += cast; return true; }
+    if (usec == INT64_MIN) { out += "'-infinity'"; out += cast; return true; }
+
+    constexpr std::int64_t kUsecPerDay = 86400ll * 1000000ll;
+    std::int64_t days = usec / kUsecPerDay;
+    std::int64_t rem = usec % kUsecPerDay;
+    if (rem < 0) {
+        rem += kUsecPerDay;
+        days--;
+    }
+
+    std::int64_t secs = rem / 1000000;
+    std::int64_t frac = rem % 1000000;
+
+    out.push_back('\'');
+    bool bc = appendDate(out, days);
+    out.push_back(' ');
+    appendPadded(out, secs / 3600, 2);
+    out.push_back(':');
+    appendPadded(out, secs / 60 % 60, 2);
+    out.push_back(':');
+    appendPadded(out, secs % 60, 2);
+    if (frac) {
+        out.push_back('.');
+        std::size_t pos = out.size();
+        appendPadded(out, frac, 6);
+        while (out.size() > pos && out.back() == '0') out.pop_back();
+    }
+    if (with_tz) out += "+00";
+    if (bc) out += " BC";
+    out.push_back('\'');
+    out += cast;
+    return true;
+}
+
+static bool appendTimestamp(std::string& out, std::string_view v) {
+    return appendTimestampValue(out, v, false);
+}
+
+static bool appendTimestampTz(std::string& out, std::string_view v) {
+    return appendTimestampValue(out, v, true);
+}
+
+/*
+numeric
+| int16 ndigits | int16 weight | uint16 sign | uint16 dscale | ndigits x int16 (base 10000) |
+value = sum digit[i] * 10000^(weight - i)
+*/
+static bool appendNumeric(std::string& out, std::string_view v) {
+    if (v.size() < 8) return false;
+    std::int16_t ndigits = static_cast<std::int16_t>(be16(v.data()));
+    std::int16_t weight  = static_cast<std::int16_t>(be16(v.data() + 2));
+    std::uint16_t sign   = be16(v.data() + 4);
+    std::uint16_t dscale = be16(v.data() + 6);
+    if (ndigits < 0 || v.size() != 8 + 2 * static_cast<std::size_t>(ndigits)) return false;
+
+    switch (sign) {
+        case 0x0000: break;
+        case 0x4000: break;
+        case 0xC000: out += "'NaN'::numeric"; return true;
+        case 0xD000: out += "'Infinity'::numeric"; return true;
+        case 0xF000: out += "'-Infinity'::numeric"; return true;
+        default: return false;
+    }
+
+    auto digit = [&](int i) -> int {
+        if (i < 0 || i >= ndigits) return 0;
+        return static_cast<std::int16_t>(be16(v.data() + 8 + 2 * i));
+    };
+
+    std::size_t start = out.size();
+    if (sign == 0x4000) out.push_back('-');
+
+    //  Integer part: groups 0..weight, first one without leading zeros
+    if (weight < 0) {
+        out.push_back('0');
+    } else {
+        appendNumber(out, digit(0));
+        for (int i = 1; i <= weight; i++) {
+            appendPadded(out, digit(i), 4);
+        }
+    }
+
+    //  Fraction: exactly dscale digits
+    if (dscale > 0) {
+        out.push_back('.');
+        int written = 0;
+        for (int i = weight + 1; written < dscale; i++) {
+            char group[4];
+            int d = digit(i);
+            for (int k = 3; k >= 0; k--) {
+                group[k] = static_cast<char>('0' + d % 10);
+                d /= 10;
+            }
+            int take = std::min(4, dscale - written);
+            out.append(group, static_cast<std::size_t>(take));
+            written += take;
+        }
+    }
+
+    //  -0 is just 0
+    if (sign == 0x4000 && out.find_first_not_of("0.", start + 1) == std::string::npos) {
+        out.erase(start, 1);
+    }
+    return true;
+}
+
+struct Decoder {
+    std::uint32_t oid;
+    bool (*append)(std::string& out, std::string_view value);
+};
+
+//  Sorted by oid, searched with lower_bound
+static constexpr Decoder kDecoders[] = {
+    { kBoolOid,        appendBool },
+    { kNameOid,        appendText },
+    { kInt8Oid,        appendInt8 },
+    { kInt2Oid,        appendInt2 },
+    { kInt4Oid,        appendInt4 },
+    { kTextOid,        appendText },
+    { kOidOid,         appendOid },
+    { kFloat4Oid,      appendFloat4 },
+    { kFloat8Oid,      appendFloat8 },
+    { kBpcharOid,      appendText },
+    { kVarcharOid,     appendText },
+    { kDateOid,        appendDateValue },
+    { kTimestampOid,   appendTimestamp },
+    { kTimestampTzOid, appendTimestampTz },
+    { kNumericOid,     appendNumeric },
+    { kUuidOid,        appendUuid },
+};
+
+static constexpr bool sortedByOid() {
+    for (std::size_t i = 1; i < std::size(kDecoders); i++) {
+        if (kDecoders[i - 1].oid >= kDecoders[i].oid) return false;
+    }
+    return true;
+}
+static_assert(sortedByOid(), "kDecoders must be sorted by oid");
+
+bool appendLiteral(std::string& out, std::uint32_t oid, std::string_view value) {
+    auto it = std::lower_bound(std::begin(kDecoders), std::end(kDecoders), oid,
+                               [](const Decoder& d, std::uint32_t key) { return d.oid < key; });
+    if (it == std::end(kDecoders) || it->oid != oid) return false;
+    return it->append(out, value);
+}
+
+}  // namespace pgbinary
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+//  Binary-format (format code 1) Bind values -> SQL literal text
+//  Decoders are picked by parameter type OID from a table fixed at compile time
+
+namespace pgbinary {
+
+//  Type OIDs from pg_type.h
+constexpr std::uint32_t kBoolOid        = 16;
+constexpr std::uint32_t kNameOid        = 19;
+constexpr std::uint32_t kInt8Oid        = 20;
+constexpr std::uint32_t kInt2Oid        = 21;
+constexpr std::uint32_t kInt4Oid        = 23;
+constexpr std::uint32_t kTextOid        = 25;
+constexpr std::uint32_t kOidOid         = 26;
+constexpr std::uint32_t kFloat4Oid      = 700;
+constexpr std::uint32_t kFloat8Oid      = 701;
+constexpr std::uint32_t kBpcharOid      = 1042;
+constexpr std::uint32_t kVarcharOid     = 1043;
+constexpr std::uint32_t kDateOid        = 1082;
+constexpr std::uint32_t kTimestampOid   = 1114;
+constexpr std::uint32_t kTimestampTzOid = 1184;
+constexpr std::uint32_t kNumericOid     = 1700;
+constexpr std::uint32_t kUuidOid        = 2950;
+
+//  Appends literal for value of type oid, false when oid is not known
+//  or value is malformed, then out is untouched and caller falls back
+bool appendLiteral(std::string& out, std::uint32_t oid, std::string_view value);
+
+}  // namespace pgbinary
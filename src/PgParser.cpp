@@ -1,7 +1,19 @@
 #include "PgParser.h"
 
-PgQueryParser::PgQueryParser(QueryCallback cb)
-    : callback_(std::move(cb)) {}
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+#include "PgBinary.h"
+#include "Profile.h"
+#include "TextScan.h"
+
+PgQueryParser::PgQueryParser(QueryCallback cb, ResultCallback on_result,
+                             ParserLimits limits, bool track_responses)
+    : callback_(std::move(cb))
+    , result_(std::move(on_result))
+    , limits_(limits)
+    , track_responses_(track_responses) {}
 
 
 /*
@@ -36,24 +48,326 @@ std::uint16_t PgQueryParser::be16(const char* p) {
 }
 
 PgQueryParser::ConnState& PgQueryParser::stateFor(Connection& conn) {
-    return states_[&conn];
+    if (conn.interceptor_state) {
+        return *static_cast<ConnState*>(conn.interceptor_state);
+    }
+
+    ConnState* st = nullptr;
+    if (free_states_.empty()) {
+        states_.push_back(std::make_unique<ConnState>());
+        st = states_.back().get();
+    } else {
+        st = free_states_.back();
+        free_states_.pop_back();
+    }
+
+    conn.interceptor_state = st;
+    return *st;
 }
 
-void PgQueryParser::onConnectionClosed(const Connection& conn) {
-    states_.erase(&conn);
+void PgQueryParser::onConnectionClosed(Connection& conn) {
+    if (!conn.interceptor_state) return;
+
+    auto* st = static_cast<ConnState*>(conn.interceptor_state);
+    conn.interceptor_state = nullptr;
+
+    //  Sent but never answered, still worth a log line
+    flushResults(conn, *st, true);
+    if (st->records.capacity() > kKeepBufBytes) {
+        std::string().swap(st->records);
+    }
+    if (st->pending.capacity() > kPendingCompact) {
+        decltype(st->pending)().swap(st->pending);
+    }
+    st->server_buf.clear();
+    st->server_skip = 0;
+    st->ssl_requested = false;
+    st->encrypted = false;
+    st->server_lost = false;
+
+    //  Keep small allocations for the next link, free big ones
+    if (st->buf.capacity() > kKeepBufBytes) {
+        std::string().swap(st->buf);
+    } else {
+        st->buf.clear();
+    }
+
+    if (st->statements.bucket_count() > kKeepBuckets) {
+        decltype(st->statements)().swap(st->statements);
+    } else {
+        st->statements.clear();
+    }
+
+    if (st->portals.bucket_count() > kKeepBuckets) {
+        decltype(st->portals)().swap(st->portals);
+    } else {
+        st->portals.clear();
+    }
+
+    if (st->evicted.bucket_count() > kKeepBuckets) {
+        decltype(st->evicted)().swap(st->evicted);
+    } else {
+        st->evicted.clear();
+    }
+    st->lru.prev = st->lru.next = &st->lru;
+    st->lru_bytes = 0;
+
+    //  Arenas keep up to kKeepBufBytes each
+    st->named_arena.reset();
+    st->named_live_bytes = 0;
+    st->unnamed_statement = Statement();
+    st->unnamed_statement_arena.reset();
+    st->unnamed_parsed = false;
+    st->portal_arena.reset();
+    st->unnamed_bound = false;
+
+    st->startup_skipped = false;
+
+    //  Pooled leftovers are not charged to anyone
+    memory_bytes_.store(memory_bytes_.load(std::memory_order_relaxed) - st->accounted_bytes,
+                        std::memory_order_relaxed);
+    st->accounted_bytes = 0;
+
+    free_states_.push_back(st);
+}
+
+//  Heap held by one link: stream tail, arenas, map nodes and buckets
+std::size_t PgQueryParser::stateBytes(const ConnState& st) {
+    constexpr std::size_t kNodeOverhead = 2 * sizeof(void*) + sizeof(std::size_t);
+    return st.buf.capacity()
+         + st.records.capacity()
+         + st.server_buf.capacity()
+         + st.pending.capacity() * sizeof(Pending)
+         + st.named_arena.reserved()
+         + st.unnamed_statement_arena.reserved()
+         + st.portal_arena.reserved()
+         + st.statements.size() * (sizeof(decltype(st.statements)::value_type) + kNodeOverhead)
+         + st.portals.size() * (sizeof(decltype(st.portals)::value_type) + kNodeOverhead)
+         + st.evicted.size() * (sizeof(std::uint64_t) + kNodeOverhead)
+         + (st.statements.bucket_count() + st.portals.bucket_count() + st.evicted.bucket_count()) * sizeof(void*);
+}
+
+//  Single writer per parser, plain load/store instead of locked add
+void PgQueryParser::account(ConnState& st) {
+    std::size_t bytes = stateBytes(st);
+    if (bytes == st.accounted_bytes) return;
+
+    memory_bytes_.store(memory_bytes_.load(std::memory_order_relaxed) + bytes - st.accounted_bytes,
+                        std::memory_order_relaxed);
+    st.accounted_bytes = bytes;
+
+    if (bytes > peak_link_bytes_.load(std::memory_order_relaxed)) {
+        peak_link_bytes_.store(bytes, std::memory_order_relaxed);
+    }
 }
 
 void PgQueryParser::onClientData(Connection& conn, const char* data, std::size_t len) {
     if (!callback_ || len == 0) return;
 
     auto& st = stateFor(conn);
-    st.buf.append(data, len);
-    processBuffer(conn, st);
+    if (st.encrypted) return;
+    if (track_responses_) now_ns_ = nowNs();
+
+    //  Nothing pending: parse the chunk in place, keep only an unfinished tail
+    if (st.buf.empty()) {
+        std::size_t used = processBuffer(conn, st, data, len);
+        if (used < len) {
+            st.buf.assign(data + used, len - used);
+        }
+    } else {
+        st.buf.append(data, len);
+        std::size_t used = processBuffer(conn, st, st.buf.data(), st.buf.size());
+        st.buf.erase(0, used);  //  One compaction per call
+    }
+
+    //  Untracked queries of this chunk, as one span
+    emitResults(conn, record_);
+    record_.clear();
+
+    account(st);
+}
+
+//  Template is shared through the intern table, only types take arena bytes
+PgQueryParser::Statement PgQueryParser::makeStatement(Arena& arena, TemplateIntern::Ref tmpl,
+                                                      const char* types, std::uint16_t ntypes) {
+    Statement statement;
+    statement.tmpl = std::move(tmpl);
+    statement.num_param_types = ntypes;
+    if (ntypes > 0) {
+        std::uint32_t* out = arena.allocateArray<std::uint32_t>(ntypes);
+        for (std::uint16_t i = 0; i < ntypes; i++) {
+            out[i] = be32(types + 4 * i);
+        }
+        statement.param_types = out;
+    }
+    statement.bytes = 4 * static_cast<std::size_t>(ntypes);
+    return statement;
+}
+
+//  Re-Parse of same text keeps the old reference, shared table is not touched
+TemplateIntern::Ref PgQueryParser::internTemplate(std::string_view query, Statement* previous) {
+    if (previous && previous->tmpl.text() == query) {
+        return std::move(previous->tmpl);
+    }
+    return TemplateIntern::shared().intern(query);
+}
+
+PgQueryParser::Statement* PgQueryParser::findStatement(ConnState& st, std::string_view name) {
+    if (name.empty()) {
+        return st.unnamed_parsed ? &st.unnamed_statement : nullptr;
+    }
+    auto it = st.statements.find(name);
+    return it == st.statements.end() ? nullptr : &it->second;
+}
+
+//  Arena bytes of a dropped entry stay dead until compactNamed
+void PgQueryParser::dropNamedStatement(ConnState& st, std::string_view name) {
+    auto it = st.statements.find(name);
+    if (it == st.statements.end()) return;
+    st.named_live_bytes -= it->second.bytes;
+    lruUnlink(st, &it->second);
+    st.statements.erase(it);
+}
+
+void PgQueryParser::dropNamedPortal(ConnState& st, std::string_view name) {
+    auto it = st.portals.find(name);
+    if (it == st.portals.end()) return;
+    st.named_live_bytes -= it->second.bytes;
+    lruUnlink(st, &it->second);
+    st.portals.erase(it);
+}
+
+//  Copy live named entries into a fresh arena, old one goes away with the dead ones
+void PgQueryParser::compactNamed(ConnState& st) {
+    if (st.named_arena.used() < 2 * st.named_live_bytes + kCompactSlack) return;
+
+    Arena fresh(4096, kKeepBufBytes);
+    decltype(st.statements) statements;
+    decltype(st.portals) portals;
+    statements.reserve(st.statements.size());
+    portals.reserve(st.portals.size());
+
+    //  Walked in recency order, copies are chained the same way under a local head
+    LruNode order;
+    order.prev = order.next = &order;
+    auto chain = [&order](LruNode* node) {
+        node->prev = order.prev;
+        node->next = &order;
+        order.prev->next = node;
+        order.prev = node;
+    };
+
+    for (LruNode* node = st.lru.next; node != &st.lru; node = node->next) {
+        if (!node->is_portal) {
+            auto& old = static_cast<Statement&>(*node);
+            Statement statement = std::move(old);
+            if (old.num_param_types > 0) {
+                std::uint32_t* types = fresh.allocateArray<std::uint32_t>(old.num_param_types);
+                std::copy(old.param_types, old.param_types + old.num_param_types, types);
+                statement.param_types = types;
+            }
+            statement.name = fresh.copy(old.name);
+            chain(&statements.emplace(statement.name, std::move(statement)).first->second);
+            continue;
+        }
+
+        const auto& old = static_cast<const Portal&>(*node);
+        Portal portal = old;
+        portal.statement_name = fresh.copy(old.statement_name);
+        if (old.num_params > 0) {
+            Param* params = fresh.allocateArray<Param>(old.num_params);
+            for (std::uint16_t i = 0; i < old.num_params; i++) {
+                params[i] = old.params[i];
+                if (old.params[i].len > 0) {
+                    params[i].data = fresh.copy(std::string_view(old.params[i].data, old.params[i].len)).data();
+                }
+            }
+            portal.params = params;
+        }
+        portal.name = fresh.copy(old.name);
+        chain(&portals.emplace(portal.name, portal).first->second);
+    }
+
+    st.statements.swap(statements);
+    st.portals.swap(portals);
+    st.named_arena = std::move(fresh);
+
+    //  Every named entry is linked, so the local chain holds all of them
+    if (order.next == &order) {
+        st.lru.prev = st.lru.next = &st.lru;
+    } else {
+        st.lru.next = order.next;
+        st.lru.prev = order.prev;
+        st.lru.next->prev = &st.lru;
+        st.lru.prev->next = &st.lru;
+    }
+}
+
+//  Most recent at the tail, eviction takes from the head
+void PgQueryParser::lruLink(ConnState& st, LruNode* node) {
+    node->prev = st.lru.prev;
+    node->next = &st.lru;
+    st.lru.prev->next = node;
+    st.lru.prev = node;
+    st.lru_bytes += node->cost;
+}
+
+void PgQueryParser::lruUnlink(ConnState& st, LruNode* node) {
+    if (!node->prev) return;
+    node->prev->next = node->next;
+    node->next->prev = node->prev;
+    node->prev = node->next = nullptr;
+    st.lru_bytes -= node->cost;
+}
+
+void PgQueryParser::lruTouch(ConnState& st, LruNode* node) {
+    if (!node->prev || node->next == &st.lru) return;
+    lruUnlink(st, node);
+    lruLink(st, node);
+}
+
+std::uint64_t PgQueryParser::evictedKey(bool is_portal, std::string_view name) {
+    return (static_cast<std::uint64_t>(std::hash<std::string_view>()(name)) << 1) | (is_portal ? 1 : 0);
+}
+
+//  Drops least recently used entries until the link fits, never the one just added
+void PgQueryParser::enforceLimits(ConnState& st, const LruNode* keep) {
+    auto over = [&] {
+        return (limits_.max_entries && st.statements.size() + st.portals.size() > limits_.max_entries)
+            || (limits_.max_bytes && st.lru_bytes > limits_.max_bytes);
+    };
+
+    while (over()) {
+        LruNode* victim = st.lru.next;
+        if (victim == keep) victim = victim->next;
+        if (victim == &st.lru) return;
+
+        //  Forgetting old names is fine, the counter is best effort
+        if (st.evicted.size() >= kMaxEvictedNames) st.evicted.clear();
+        st.evicted.insert(evictedKey(victim->is_portal, victim->name));
+
+        //  Name view stays valid, dropped bytes live in the arena until compaction
+        if (victim->is_portal) {
+            dropNamedPortal(st, victim->name);
+        } else {
+            dropNamedStatement(st, victim->name);
+        }
+        evictions_.store(evictions_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+}
+
+//  Entry a message refers to is not tracked, count it if the cap dropped it
+void PgQueryParser::noteMiss(ConnState& st, bool is_portal, std::string_view name) {
+    if (name.empty() || st.evicted.empty()) return;
+    if (st.evicted.count(evictedKey(is_portal, name))) {
+        evicted_executed_.store(evicted_executed_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
 }
 
-std::string PgQueryParser::readCString(const char* msg, std::size_t total, std::size_t& pos) {
+//  View into the message, valid while the message is
+std::string_view PgQueryParser::readCString(const char* msg, std::size_t total, std::size_t& pos) {
     if (pos >= total) {
-        return std::string();
+        return std::string_view();
     }
 
     auto start = pos;
@@ -61,72 +375,92 @@ std::string PgQueryParser::readCString(const char* msg, std::size_t total, std::
         pos++;
     }
 
-    std::string res(msg + start, msg + pos);
+    std::string_view res(msg + start, pos - start);
     pos++;  //  For terminator
     return res;
 }
 
-void PgQueryParser::processBuffer(Connection& conn, ConnState& state) {
+//  Walks complete messages with a cursor, returns bytes consumed
+std::size_t PgQueryParser::processBuffer(Connection& conn, ConnState& state, const char* data, std::size_t size) {
+    PROFILE_SCOPE(kProcessBuffer);
+
+    std::size_t pos = 0;
 
     //  Tryin' to find StartupMessage first, then parse after it
-    if (!state.startup_skipped) {
-        if (state.buf.size() < 4) {
-            return;
+    //  SSLRequest/GSSENCRequest may come before it, answered by one bare byte
+    while (!state.startup_skipped) {
+        if (size - pos < 4) {
+            return pos;
         }
 
-        std::uint32_t len = be32(state.buf.data());
+        std::uint32_t len = be32(data + pos);
         if (len < 4 || len > (1u << 26)) {  //  64MB safety
             state.startup_skipped = true;   //  Too big len, assume skip
-        } else {
-            if (state.buf.size() < len) {
-                return;  //  Waiting for whole data
-            }
-            state.buf.erase(0, len);
-            state.startup_skipped = true;
+            break;
+        }
+        if (size - pos < len) {
+            return pos;  //  Waiting for whole data
+        }
+
+        std::uint32_t code = len == 8 ? be32(data + pos + 4) : 0;
+        pos += len;
+        if (code == kSslRequestCode || code == kGssEncRequestCode) {
+            state.ssl_requested = true;
+            continue;
         }
+        state.startup_skipped = true;
     }
 
     //  Then we can parse usual query here
     while (true) {
-        if (state.buf.size() < 5) {
-            return;  //  Waiting for whole data
+        if (size - pos < 5) {
+            return pos;  //  Waiting for whole data
         }
 
-        const char* msg = state.buf.data();
+        const char* msg = data + pos;
         char type = msg[0];
         std::uint32_t len = be32(msg + 1);
         std::uint32_t total_len = len + 1;  //  Type field not counted, so we add it here
 
         // Safety, sanity
         if (len < 4 || total_len > (1u << 26)) {
-            state.buf.clear();
-            return;
+            return size;  //  Drop everything
         }
 
-        if (state.buf.size() < total_len) {
-            return;  //  Waiting for whole data
+        if (size - pos < total_len) {
+            return pos;  //  Waiting for whole data
         }
 
         switch (type) {
             case 'Q':
+                countMessage(WorkerMetrics::kQuery);
+                pushRequest(conn, state, type);
                 handleSimpleQuery(conn, state, msg, total_len);
                 break;
             case 'P':
+                countMessage(WorkerMetrics::kParse);
                 handleParse(conn, state, msg, total_len);
                 break;
             case 'B':
+                countMessage(WorkerMetrics::kBind);
                 handleBind(conn, state, msg, total_len);
                 break;
             case 'E':
+                countMessage(WorkerMetrics::kExecute);
+                pushRequest(conn, state, type);
                 handleExecute(conn, state, msg, total_len);
                 break;
+            case 'S':  //  Sync
+            case 'F':  //  FunctionCall
+                pushRequest(conn, state, type);
+                break;
             case 'C':
                 handleClose(conn, state, msg, total_len);
                 break;
             default:
                 break;
         }
-        state.buf.erase(0, total_len);
+        pos += total_len;
     }
 }
 
@@ -144,7 +478,7 @@ String: query string (zero-terminated)
 | query      | 5   | var+1     | C-string (0-terminated)         |
 **/
 
-void PgQueryParser::handleSimpleQuery(Connection& conn, ConnState&, const char* msg, std::size_t total_len) {
+void PgQueryParser::handleSimpleQuery(Connection& conn, ConnState& st, const char* msg, std::size_t total_len) {
     const char* query_data = msg + 5;
     std::size_t query_len = total_len - 5;
 
@@ -152,8 +486,9 @@ void PgQueryParser::handleSimpleQuery(Connection& conn, ConnState&, const char*
         query_len--;
     }
 
-    std::string query(query_data, query_len);
-    callback_(conn, query);
+    PgQuery query;
+    query.text = std::string_view(query_data, query_len);
+    emitQuery(conn, st, query);
 }
 
 /**
@@ -180,27 +515,39 @@ Repeat N times:
 void PgQueryParser::handleParse(Connection&, ConnState& st, const char* msg, std::size_t total) {
     std::size_t pos = 5;
 
-    std::string statement_name = readCString(msg, total, pos);
-    std::string query          = readCString(msg, total, pos);
+    std::string_view statement_name = readCString(msg, total, pos);
+    std::string_view query          = readCString(msg, total, pos);
 
     if (pos + 2 > total) return;
     std::uint16_t nparams = be16(msg + pos);
     pos += 2;
-
-    std::vector<std::uint32_t> types;
-    types.reserve(nparams);
-    for (std::uint16_t i = 0; i < nparams; ++i) {
-        if (pos + 4 > total) return;
-        std::uint32_t t = be32(msg + pos);
-        pos += 4;
-        types.push_back(t);
+    if (pos + 4 * static_cast<std::size_t>(nparams) > total) return;
+
+    //  Unnamed one is replaced by every unnamed Parse, its arena starts over
+    if (statement_name.empty()) {
+        TemplateIntern::Ref tmpl = internTemplate(query, st.unnamed_parsed ? &st.unnamed_statement : nullptr);
+        st.unnamed_statement_arena.reset();
+        st.unnamed_statement = makeStatement(st.unnamed_statement_arena, std::move(tmpl), msg + pos, nparams);
+        st.unnamed_parsed = true;
+        return;
     }
 
-    Statement statement;
-    statement.pg_template = std::move(query);
-    statement.param_types  = std::move(types);
-
-    st.statements[statement_name] = std::move(statement);
+    auto it = st.statements.find(statement_name);
+    TemplateIntern::Ref tmpl = internTemplate(query, it != st.statements.end() ? &it->second : nullptr);
+    dropNamedStatement(st, statement_name);
+    compactNamed(st);
+
+    Statement statement = makeStatement(st.named_arena, std::move(tmpl), msg + pos, nparams);
+    std::string_view key = st.named_arena.copy(statement_name);
+    statement.bytes += key.size();
+    statement.name = key;
+    statement.cost = statement.bytes + statement.tmpl.text().size();
+    st.named_live_bytes += statement.bytes;
+
+    Statement& entry = st.statements.emplace(key, std::move(statement)).first->second;
+    lruLink(st, &entry);
+    if (!st.evicted.empty()) st.evicted.erase(evictedKey(false, key));
+    enforceLimits(st, &entry);
 }
 
 /**
@@ -240,60 +587,46 @@ Repeat R times:
 
 void PgQueryParser::handleBind(Connection&, ConnState& state, const char* msg, std::size_t total_len) {
     std::size_t pos = 5;
-    std::string portal_name = readCString(msg, total_len, pos);
-    std::string statement_name = readCString(msg, total_len, pos);
+    std::string_view portal_name = readCString(msg, total_len, pos);
+    std::string_view statement_name = readCString(msg, total_len, pos);
 
     if (pos + 2 > total_len) return;
     std::uint16_t num_format_codes = be16(msg + pos);
     pos += 2;
 
-    std::vector<std::uint16_t> format_codes;
-    format_codes.reserve(num_format_codes);
-    for (std::uint16_t i = 0; i < num_format_codes; i++) {
-        if (pos + 2 > total_len) return;
-        format_codes.push_back(be16(msg + pos));
-        pos += 2;
-    }
-
+    //  Format codes are read in place, no copy
+    const char* format_codes = msg + pos;
+    pos += 2 * static_cast<std::size_t>(num_format_codes);
     if (pos + 2 > total_len) return;
+
     std::uint16_t num_params = be16(msg + pos);
     pos += 2;
 
-    std::vector<std::string> params;
-    std::vector<std::uint16_t> param_formats;
-    params.reserve(num_params);
-    param_formats.reserve(num_params);
-
     auto format_for_param = [&](std::size_t idx) -> std::uint16_t {
         if (num_format_codes == 0) {  //  text by default
             return 0;  
         }
         if (num_format_codes == 1) {  //  one for all
-            return format_codes[0]; 
+            return be16(format_codes);
         }
-        if (idx < format_codes.size()) {  //  individual
-            return format_codes[idx];
+        if (idx < num_format_codes) {  //  individual
+            return be16(format_codes + 2 * idx);
         }
         return 0;
     };
 
+    //  Check pass: old portal stays intact if message is broken
+    const std::size_t params_pos = pos;
+    std::size_t value_bytes = 0;
     for (std::uint16_t i = 0; i < num_params; i++) {
         if (pos + 4 > total_len) return;
         std::int32_t param_len = static_cast<std::int32_t>(be32(msg + pos));
         pos += 4;
 
-        std::uint16_t format = format_for_param(i);
-        param_formats.push_back(format);
-
-        if (param_len == -1) {
-            params.emplace_back("NULL");
-        } else {
-            if (param_len < 0 || pos + static_cast<std::size_t>(param_len) > total_len) return;
-            
-            //  usual parameter case
-            params.emplace_back(msg + pos, msg + pos + static_cast<std::size_t>(param_len));
-            pos += static_cast<std::size_t>(param_len);
-        }
+        if (param_len == -1) continue;
+        if (param_len < 0 || pos + static_cast<std::size_t>(param_len) > total_len) return;
+        pos += static_cast<std::size_t>(param_len);
+        value_bytes += static_cast<std::size_t>(param_len);
     }
 
     //  we don't need this, that's for DB
@@ -302,13 +635,62 @@ void PgQueryParser::handleBind(Connection&, ConnState& state, const char* msg, s
     pos += 2 + 2 * num_result_formats;
     if (pos > total_len) return;
 
-    //  Fill portal
+    //  Unnamed portal replaces the previous one, its arena starts over
+    Arena* arena = &state.portal_arena;
+    if (portal_name.empty()) {
+        arena->reset();
+    } else {
+        dropNamedPortal(state, portal_name);
+        compactNamed(state);
+        arena = &state.named_arena;
+    }
+
+    //  Types come from the statement as it is now, like the server does
+    Statement* statement = findStatement(state, statement_name);
+    if (statement) lruTouch(state, statement);
+
+    //  Copy pass: param table and values go to the arena
     Portal portal;
-    portal.statement_name = std::move(statement_name);
-    portal.param_values = std::move(params);
-    portal.param_formats = std::move(param_formats);
+    portal.statement_name = arena->copy(statement_name);
+    portal.num_params = num_params;
+    portal.bytes = statement_name.size() + value_bytes + sizeof(Param) * num_params;
+
+    Param* params = num_params ? arena->allocateArray<Param>(num_params) : nullptr;
+    pos = params_pos;
+    for (std::uint16_t i = 0; i < num_params; i++) {
+        std::int32_t param_len = static_cast<std::int32_t>(be32(msg + pos));
+        pos += 4;
+
+        params[i].len = param_len;
+        params[i].format = format_for_param(i);
+        params[i].type_oid = (statement && i < statement->num_param_types) ? statement->param_types[i] : 0;
+        params[i].data = nullptr;
 
-    state.portals[portal_name] = std::move(portal);
+        if (param_len > 0) {
+            //  usual parameter case
+            params[i].data = arena->copy(std::string_view(msg + pos, static_cast<std::size_t>(param_len))).data();
+            pos += static_cast<std::size_t>(param_len);
+        }
+    }
+    portal.params = params;
+
+    if (portal_name.empty()) {
+        state.unnamed_portal = portal;
+        state.unnamed_bound = true;
+        return;
+    }
+
+    std::string_view key = arena->copy(portal_name);
+    portal.bytes += key.size();
+    portal.name = key;
+    portal.cost = portal.bytes;
+    portal.is_portal = true;
+    state.named_live_bytes += portal.bytes;
+
+    Portal& entry = state.portals.emplace(key, portal).first->second;
+    lruLink(state, &entry);
+    if (!state.evicted.empty()) state.evicted.erase(evictedKey(true, key));
+    enforceLimits(state, &entry);
 }
 
 /**
@@ -330,30 +712,45 @@ int32: max number of rows to return (0 = no limit)
 
 void PgQueryParser::handleExecute(Connection& conn, ConnState& state, const char* msg, std::size_t total_len) {
     std::size_t pos = 5;
-    std::string portal_name = readCString(msg, total_len, pos);
+    std::string_view portal_name = readCString(msg, total_len, pos);
     if (pos + 4 > total_len) return;
 
     //  Find portal
-    auto portal_it = state.portals.find(portal_name);
-    if (portal_it == state.portals.end()) {  //  if portal does not exist
-        return;
+    Portal* portal = nullptr;
+    if (portal_name.empty()) {
+        if (!state.unnamed_bound) return;
+        portal = &state.unnamed_portal;
+    } else {
+        auto portal_it = state.portals.find(portal_name);
+        if (portal_it == state.portals.end()) {  //  if portal does not exist
+            noteMiss(state, true, portal_name);
+            return;
+        }
+        portal = &portal_it->second;
+        lruTouch(state, portal);
     }
 
     //  Find statement, that was in portal
-    const Portal& portal = portal_it->second;
-    auto statement_it = state.statements.find(portal.statement_name);
-    if (statement_it == state.statements.end()) {
+    Statement* statement = findStatement(state, portal->statement_name);
+    if (!statement) {
+        noteMiss(state, false, portal->statement_name);
         return;  //  if statement does not exist
     }
-    const Statement& statement = statement_it->second;
-
-    //  Align
-    std::string pg_query = makeupPreparedQuery(statement, portal);
-    callback_(conn, pg_query);
-
-    //  We should delete unnamed portal
+    lruTouch(state, statement);
+
+    //  Sink decides if and where $n get substituted
+    PgQuery query;
+    query.text = statement->tmpl.text();
+    query.fingerprint = statement->tmpl.fingerprint();
+    query.params = portal->params;
+    query.num_params = portal->num_params;
+    query.prepared = true;
+    emitQuery(conn, state, query);
+
+    //  We should drop unnamed portal, arena chunks are kept for next Bind
     if (portal_name.empty()) {
-        state.portals.erase(portal_it);
+        state.unnamed_bound = false;
+        state.portal_arena.reset();
     }
 }
 
@@ -380,72 +777,477 @@ void PgQueryParser::handleClose(Connection&, ConnState& st, const char* msg, std
     char target = msg[pos];
     pos++;
 
-    std::string name = readCString(msg, total, pos);
+    std::string_view name = readCString(msg, total, pos);
 
     if (target == 'S') {
-        st.statements.erase(name);
+        if (name.empty()) {
+            st.unnamed_parsed = false;
+            st.unnamed_statement = Statement();
+            st.unnamed_statement_arena.reset();
+        } else {
+            dropNamedStatement(st, name);
+        }
     } else if (target == 'P') {
-        st.portals.erase(name);
+        if (name.empty()) {
+            st.unnamed_bound = false;
+            st.portal_arena.reset();
+        } else {
+            dropNamedPortal(st, name);
+        }
+    }
+}
+
+std::int64_t PgQueryParser::nowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+//  Q/E/S/F each get a queue entry, the server answers them in the same order
+void PgQueryParser::pushRequest(const Connection& conn, ConnState& st, char kind) {
+    if (!tracking(st)) return;
+    if (st.pending.size() - st.pending_head >= kMaxPending) {
+        loseServer(conn, st);  //  Server is not answering, or we lost the thread
+        return;
+    }
+
+    Pending pending;
+    pending.kind = kind;
+    pending.start_ns = now_ns_;
+    pending.record_off = st.records.size();
+    st.pending.push_back(pending);
+}
+
+//  Sink record is kept with the request pushed for this message
+void PgQueryParser::emitQuery(const Connection& conn, ConnState& st, const PgQuery& query) {
+    if (!tracking(st)) {
+        std::size_t off = record_.size();
+        callback_(conn, query, record_);
+        if (record_.size() > off) {
+            finished_.push_back(Finished{ off, record_.size() - off, PgResult() });
+        }
+        return;
+    }
+
+    Pending& pending = st.pending.back();
+    callback_(conn, query, st.records);
+    pending.record_len = st.records.size() - pending.record_off;
+}
+
+//  Answered requests leave from the front, in order; all = link is going away
+void PgQueryParser::flushResults(const Connection& conn, ConnState& st, bool all) {
+    while (st.pending_head < st.pending.size()) {
+        const Pending& pending = st.pending[st.pending_head];
+        if (!pending.done && !all) break;
+        if (pending.record_len > 0) {
+            finished_.push_back(Finished{ pending.record_off, pending.record_len, pending.result });
+        }
+        st.pending_head++;
+    }
+    emitResults(conn, st.records);
+
+    if (st.pending_head == st.pending.size()) {
+        st.pending.clear();
+        st.pending_head = 0;
+        st.records.clear();
+        return;
+    }
+
+    //  Pipelined link may never drain, drop the answered front now and then
+    if (st.pending_head >= kPendingCompact) {
+        std::size_t cut = st.pending[st.pending_head].record_off;
+        st.records.erase(0, cut);
+        st.pending.erase(st.pending.begin(), st.pending.begin() + static_cast<std::ptrdiff_t>(st.pending_head));
+        for (Pending& pending : st.pending) {
+            pending.record_off -= cut;
+        }
+        st.pending_head = 0;
+    }
+}
+
+//  One callback for everything finished so far, records stay untouched till it returns
+void PgQueryParser::emitResults(const Connection& conn, std::string_view records) {
+    if (finished_.empty()) return;
+
+    if (result_) {
+        batch_.clear();
+        for (const Finished& done : finished_) {
+            batch_.push_back(PgResultEntry{ records.substr(done.off, done.len), done.result });
+        }
+        result_(conn, batch_);
+    }
+    finished_.clear();
+}
+
+//  Waiting queries are reported with unknown results, new ones right away
+void PgQueryParser::loseServer(const Connection& conn, ConnState& st) {
+    st.server_lost = true;
+    st.server_buf.clear();
+    st.server_skip = 0;
+    flushResults(conn, st, true);
+}
+
+//  Replies that finish a request; everything else is skipped by its length
+bool PgQueryParser::isTrackedReply(char type) {
+    return type == 'C' || type == 'E' || type == 'Z' || type == 'I' || type == 's';
+}
+
+void PgQueryParser::onServerData(Connection& conn, const char* data, std::size_t len) {
+    if (!track_responses_ || !callback_ || len == 0 || !conn.interceptor_state) return;
+
+    auto& st = stateFor(conn);
+    if (st.server_lost || st.encrypted) return;
+    now_ns_ = nowNs();
+
+    //  'N' = go on in plain text, anything else = encrypted from here on
+    if (st.ssl_requested) {
+        st.ssl_requested = false;
+        if (data[0] != 'N') {
+            st.encrypted = true;
+            loseServer(conn, st);
+            account(st);
+            return;
+        }
+        data++;
+        len--;
+    }
+
+    while (len > 0) {
+        if (st.server_skip > 0) {
+            std::size_t skip = std::min(st.server_skip, len);
+            st.server_skip -= skip;
+            data += skip;
+            len -= skip;
+            continue;
+        }
+
+        //  Nothing split: walk in place, keep a header or tracked reply tail
+        if (st.server_buf.empty()) {
+            std::size_t used = processServerBuffer(conn, st, data, len);
+            if (!st.server_lost && used < len) {
+                st.server_buf.assign(data + used, len - used);
+            }
+            break;
+        }
+
+        //  Tail of last read: finish the header first, untracked body is skipped
+        if (st.server_buf.size() < 5) {
+            std::size_t take = std::min<std::size_t>(5 - st.server_buf.size(), len);
+            st.server_buf.append(data, take);
+            data += take;
+            len -= take;
+            if (st.server_buf.size() < 5) break;
+        }
+
+        std::uint32_t msg_len = be32(st.server_buf.data() + 1);
+        if (msg_len < 4 || msg_len > (1u << 26)) {
+            loseServer(conn, st);
+            break;
+        }
+        std::size_t total = static_cast<std::size_t>(msg_len) + 1;
+
+        if (!isTrackedReply(st.server_buf[0])) {
+            st.server_skip = total - st.server_buf.size();
+            st.server_buf.clear();
+            continue;
+        }
+
+        std::size_t take = std::min(total - st.server_buf.size(), len);
+        st.server_buf.append(data, take);
+        data += take;
+        len -= take;
+        if (st.server_buf.size() < total) break;
+
+        handleServerMessage(st, st.server_buf.data(), total);
+        st.server_buf.clear();
+    }
+
+    flushResults(conn, st, false);
+    account(st);
+}
+
+//  Like processBuffer, but an untracked reply only needs its header
+std::size_t PgQueryParser::processServerBuffer(Connection& conn, ConnState& st, const char* data, std::size_t size) {
+    std::size_t pos = 0;
+    while (size - pos >= 5) {
+        const char* msg = data + pos;
+        std::uint32_t len = be32(msg + 1);
+        if (len < 4 || len > (1u << 26)) {
+            loseServer(conn, st);
+            return size;
+        }
+        std::size_t total_len = static_cast<std::size_t>(len) + 1;
+
+        //  DataRow and the like: payload is passed over, not stored
+        if (!isTrackedReply(msg[0])) {
+            if (size - pos < total_len) {
+                st.server_skip = total_len - (size - pos);
+                return size;
+            }
+            pos += total_len;
+            continue;
+        }
+
+        if (size - pos < total_len) {
+            return pos;  //  Waiting for whole data
+        }
+        handleServerMessage(st, msg, total_len);
+        pos += total_len;
+    }
+    return pos;
+}
+
+//  "INSERT 0 5" -> 5, "SELECT 3" -> 3, "CREATE TABLE" -> -1
+std::int64_t PgQueryParser::commandRows(std::string_view tag) {
+    std::size_t space = tag.rfind(' ');
+    if (space == std::string_view::npos || space + 1 == tag.size()) return -1;
+
+    std::int64_t rows = 0;
+    for (char c : tag.substr(space + 1)) {
+        if (c < '0' || c > '9') return -1;
+        rows = rows * 10 + (c - '0');
+    }
+    return rows;
+}
+
+/**
+Server replies that finish requests
+CommandComplete   'C' int32 len, String: command tag ("SELECT 5")
+ErrorResponse     'E' int32 len, { Byte1 field code, String value }*, Byte1 0
+ReadyForQuery     'Z' int32 len, Byte1 transaction status
+EmptyQueryResponse 'I' int32 len
+PortalSuspended   's' int32 len
+
+| request   | finished by                                            |
+|-----------|--------------------------------------------------------|
+| Execute   | C, I, s or E; after an E the rest up to Sync never run |
+| Query     | Z, C and E on the way give rows and SQLSTATE           |
+| Sync, F   | Z                                                      |
+**/
+
+void PgQueryParser::handleServerMessage(ConnState& st, const char* msg, std::size_t total_len) {
+    //  Oldest request still waiting, none = startup's Z or an async notice
+    std::size_t i = st.pending_head;
+    while (i < st.pending.size() && st.pending[i].done) i++;
+    if (i == st.pending.size()) return;
+
+    Pending& pending = st.pending[i];
+    switch (msg[0]) {
+        case 'C':
+        case 'I':
+        case 's': {
+            std::int64_t rows = -1;
+            if (msg[0] == 'C') {
+                std::size_t pos = 5;
+                rows = commandRows(readCString(msg, total_len, pos));
+            }
+            if (pending.kind == 'E') {
+                pending.result.rows = rows;
+                pending.result.duration_ns = now_ns_ - pending.start_ns;
+                pending.done = true;
+            } else if (pending.kind == 'Q' && rows >= 0) {
+                pending.result.rows = rows;  //  Last statement of the string wins
+            }
+            break;
+        }
+        case 'E': {
+            //  Error of a Parse/Bind with no Execute behind it has no query to report
+            if (pending.kind != 'E' && pending.kind != 'Q') break;
+
+            std::size_t pos = 5;
+            while (pos < total_len && msg[pos] != '\0') {
+                char code = msg[pos++];
+                std::string_view value = readCString(msg, total_len, pos);
+                if (code == 'C') {
+                    std::size_t n = std::min(value.size(), sizeof(pending.result.sqlstate) - 1);
+                    std::memcpy(pending.result.sqlstate, value.data(), n);
+                    pending.result.sqlstate[n] = '\0';
+                    break;
+                }
+            }
+            if (pending.kind == 'E') {
+                pending.result.duration_ns = now_ns_ - pending.start_ns;
+                pending.done = true;
+            }
+            break;
+        }
+        case 'Z':
+            //  Finishes everything up to the Sync or Query it answers
+            for (; i < st.pending.size(); i++) {
+                Pending& waiting = st.pending[i];
+                if (waiting.done) continue;
+                waiting.done = true;
+                if (waiting.kind == 'E') {
+                    waiting.result.skipped = true;
+                    continue;
+                }
+                waiting.result.duration_ns = now_ns_ - waiting.start_ns;
+                break;
+            }
+            break;
+        default:
+            break;
     }
 }
 
 //  Bind to query 
 //  format_code = 0 — text param
-//  format_code = 1 — binary param (bytea)
+//  format_code = 1 — binary param, decoded by type OID, unknown type -> bytea
 
-std::string PgQueryParser::formatParamForSql(const std::string& value, std::uint16_t format_code) {
-    if (value == "NULL") {
-        return "NULL";
-    }
+void PgQueryParser::appendParamForSql(std::string& out, const Param& param) {
+    std::string_view value(param.data, static_cast<std::size_t>(param.len));
 
-    if (format_code == 1) {
-        return formatByteaLiteral(value);
+    if (param.format == 1) {
+        if (!pgbinary::appendLiteral(out, param.type_oid, value)) {
+            appendByteaLiteral(out, value);
+        }
+        return;
     }
 
     if (isIntegerLiteral(value) || isFloatLiteral(value)) {
-        return value;
+        out += value;
+        return;
     }
 
-    return formatStringLiteral(value);
+    appendStringLiteral(out, value);
 }
 
-std::string PgQueryParser::makeupPreparedQuery(const Statement& statement, const Portal& portal) {
-    const std::string& tmpl = statement.pg_template;
-    const auto& params = portal.param_values;
-    const auto& formats = portal.param_formats;
-
-    std::string out;
+//  Substitutes $n, param_at(idx) gives the PgParam for $idx+1
+template <typename ParamAt>
+void PgQueryParser::makeupPreparedQuery(std::string_view tmpl, std::size_t num_params, ParamAt param_at, std::string& out) {
     //  Gotta go fast, 32 is ok overhead
-    out.reserve(tmpl.size() + params.size() * 32);
+    out.reserve(out.size() + tmpl.size() + num_params * 32);
 
     for (std::size_t i = 0; i < tmpl.size(); i++) {
-        char c = tmpl[i];
-        if (c == '$') {
-            std::size_t j = i + 1;  //  after $ position
-            int num = 0;
-            bool has_digit = false;
-
-            //  While we see digits -> collect a number
-            while (j < tmpl.size() && std::isdigit(static_cast<unsigned char>(tmpl[j]))) {
-                has_digit = true;
-                num = num * 10 + (tmpl[j] - '0');  //  conversion from string to int
-                j++;
-            }
+        //  Text up to next $ goes in one append
+        const char* dollar = textscan::findByte(tmpl.data() + i, tmpl.data() + tmpl.size(), '$');
+        std::size_t next = static_cast<std::size_t>(dollar - tmpl.data());
+        out.append(tmpl.data() + i, next - i);
+        if (next == tmpl.size()) break;
+        i = next;
+
+        std::size_t j = i + 1;  //  after $ position
+        int num = 0;
+        bool has_digit = false;
+
+        //  While we see digits -> collect a number
+        while (j < tmpl.size() && std::isdigit(static_cast<unsigned char>(tmpl[j]))) {
+            has_digit = true;
+            num = num * 10 + (tmpl[j] - '0');  //  conversion from string to int
+            j++;
+        }
 
-            //  Validate and insert
-            if (has_digit && num >= 1 && static_cast<std::size_t>(num) <= params.size()) {
-                std::size_t idx = static_cast<std::size_t>(num - 1);
-                std::uint16_t format_code = (idx < formats.size()) ? formats[idx] : 0;
-                out += formatParamForSql(params[idx], format_code);
-                i = j - 1; 
-                continue;
+        //  Validate and insert
+        if (has_digit && num >= 1 && static_cast<std::size_t>(num) <= num_params) {
+            Param param = param_at(static_cast<std::size_t>(num - 1));
+            if (param.len < 0) {
+                out += "NULL";
+            } else {
+                appendParamForSql(out, param);
             }
+            i = j - 1; 
+            continue;
+        }
+
+        out.push_back('$');
+    }
+}
+
+void PgQueryParser::render(const PgQuery& query, std::string& out) {
+    if (!query.prepared) {
+        out += query.text;
+        return;
+    }
+    makeupPreparedQuery(query.text, query.num_params,
+                        [&](std::size_t idx) { return query.params[idx]; }, out);
+}
+
+/*
+Packed query, host byte order, never leaves the process
+| u64 fingerprint | u32 template_len | u16 num_params | u16 prepared |
+| num_params x PackedParam | template | param values |
+*/
+
+namespace {
+struct PackedHeader {
+    std::uint64_t fingerprint;
+    std::uint32_t template_len;
+    std::uint16_t num_params;
+    std::uint16_t prepared;
+};
+
+struct PackedParam {
+    std::uint32_t offset;  //  From start of values
+    std::int32_t len;
+    std::uint32_t type_oid;
+    std::uint16_t format;
+    std::uint16_t pad;
+};
+}
+
+void PgQueryParser::pack(const PgQuery& query, std::string& out) {
+    std::size_t values = 0;
+    for (std::uint16_t i = 0; i < query.num_params; i++) {
+        if (query.params[i].len > 0) values += static_cast<std::size_t>(query.params[i].len);
+    }
+
+    std::size_t base = out.size();
+    std::size_t table = base + sizeof(PackedHeader);
+    std::size_t text = table + sizeof(PackedParam) * query.num_params;
+    out.resize(text + query.text.size() + values);
+    char* p = out.data();
+
+    PackedHeader header{ query.fingerprint, static_cast<std::uint32_t>(query.text.size()), query.num_params,
+                         static_cast<std::uint16_t>(query.prepared) };
+    std::memcpy(p + base, &header, sizeof(header));
+    if (!query.text.empty()) {
+        std::memcpy(p + text, query.text.data(), query.text.size());
+    }
+
+    std::size_t value_pos = text + query.text.size();
+    std::uint32_t offset = 0;
+    for (std::uint16_t i = 0; i < query.num_params; i++) {
+        const Param& param = query.params[i];
+        PackedParam packed{ offset, param.len, param.type_oid, param.format, 0 };
+        std::memcpy(p + table + i * sizeof(PackedParam), &packed, sizeof(packed));
+
+        if (param.len > 0) {
+            std::memcpy(p + value_pos + offset, param.data, static_cast<std::size_t>(param.len));
+            offset += static_cast<std::uint32_t>(param.len);
         }
+    }
+}
+
+std::uint64_t PgQueryParser::packedFingerprint(std::string_view packed) {
+    if (packed.size() < sizeof(PackedHeader)) return 0;
+
+    PackedHeader header;
+    std::memcpy(&header, packed.data(), sizeof(header));
+    return header.fingerprint;
+}
+
+void PgQueryParser::renderPacked(std::string_view packed, std::string& out) {
+    PROFILE_SCOPE(kRender);
+
+    if (packed.size() < sizeof(PackedHeader)) return;
 
-        out.push_back(c);
+    PackedHeader header;
+    std::memcpy(&header, packed.data(), sizeof(header));
+
+    const char* table = packed.data() + sizeof(PackedHeader);
+    const char* text = table + sizeof(PackedParam) * header.num_params;
+    const char* values = text + header.template_len;
+    std::string_view tmpl(text, header.template_len);
+
+    if (!header.prepared) {
+        out += tmpl;
+        return;
     }
 
-    return out;
+    makeupPreparedQuery(tmpl, header.num_params, [&](std::size_t idx) {
+        PackedParam packed_param;
+        std::memcpy(&packed_param, table + idx * sizeof(PackedParam), sizeof(packed_param));
+        return Param{ values + packed_param.offset, packed_param.len, packed_param.format, packed_param.type_oid };
+    }, out);
 }
 
 bool PgQueryParser::isIntegerLiteral(std::string_view s) {
@@ -502,27 +1304,14 @@ bool PgQueryParser::isFloatLiteral(std::string_view s) {
     return seen_digit && (seen_dot || seen_exp);
 }
 
-std::string PgQueryParser::formatByteaLiteral(const std::string& value) {
-    static const char* hex = "0123456789abcdef";
-    std::string out = "E'\\\\x";
-
-    for (std::uint8_t byte : value) {
-        out.push_back(hex[byte >> 4]);
-        out.push_back(hex[byte & 0x0F]);
-    }
-
+void PgQueryParser::appendByteaLiteral(std::string& out, std::string_view value) {
+    out += "E'\\\\x";
+    textscan::appendHex(out, value);
     out += "'::bytea";
-    return out;
 }
 
-std::string PgQueryParser::formatStringLiteral(const std::string& value) {
-    std::string out;
-    out.reserve(value.size() + 2);
+void PgQueryParser::appendStringLiteral(std::string& out, std::string_view value) {
     out.push_back('\'');
-    for (char c : value) {
-        if (c == '\'') out.push_back('\'');
-        out.push_back(c);
-    }
+    textscan::appendQuoteEscaped(out, value);
     out.push_back('\'');
-    return out;
 }
\ No newline at end of file
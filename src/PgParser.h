@@ -1,56 +1,277 @@
 #pragma once
 
+#include <atomic>
 #include <cstddef>
 #include <cstdint>
 #include <functional>
+#include <memory>
+#include <span>
 #include <string>
+#include <string_view>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
+#include "Arena.h"
 #include "Connection.h"
+#include "Metrics.h"
+#include "TemplateIntern.h"
+
+//  Bound parameter, data points into parser state
+struct PgParam {
+    const char* data;
+    std::int32_t len;      //  -1 = NULL
+    std::uint16_t format;  //  0=text, 1=binary
+    std::uint32_t type_oid;  //  From statement's Parse at Bind time, 0 = unspecified
+};
+
+//  Query as decoded, $n are not substituted yet
+//  Views point into parser state, valid only during the callback
+struct PgQuery {
+    std::string_view text;  //  Simple query, or template of a prepared one
+    std::uint64_t fingerprint = 0;  //  Of the template, 0 for simple query
+    const PgParam* params = nullptr;
+    std::uint16_t num_params = 0;
+    bool prepared = false;
+};
+
+//  Outcome of a Q or Execute, taken from the server's replies
+struct PgResult {
+    std::int64_t duration_ns = -1;  //  Request arrival to its completion, -1 = unknown
+    std::int64_t rows = -1;         //  From CommandComplete tag, -1 = none
+    char sqlstate[6] = {};          //  From ErrorResponse, empty = no error
+    bool skipped = false;           //  Not run, an earlier error aborted its Sync batch
+};
+
+//  Finished query: what the sink recorded for it and how it went
+struct PgResultEntry {
+    std::string_view record;
+    PgResult result;
+};
+
+//  Per-link cap on tracked named statements and portals, 0 = no cap
+//  Least recently used ones are forgotten first, the server still has them
+struct ParserLimits {
+    std::size_t max_entries = 4096;
+    std::size_t max_bytes = 4 * 1024 * 1024;  //  Arena bytes plus template text
+};
 
 //  Postgres raw stream paraser
-//  Supports Q/P/B/E/C
+//  Supports Q/P/B/E/C, and C/E/Z/I/s replies of the server to time them
 
 class PgQueryParser {
 public:
-    using QueryCallback = std::function<void(const Connection&, const std::string& pg_query)>;
-    explicit PgQueryParser(QueryCallback cb);
+    //  Sink appends what it needs later to record, kept by the parser until the result
+    //  Empty record = sink is not interested in this query
+    using QueryCallback = std::function<void(const Connection&, const PgQuery& query, std::string& record)>;
+    //  Finished queries in request order, one span per client or server chunk parsed,
+    //  so a pipelined batch up to its Sync usually arrives whole
+    //  Without response tracking: every query of the chunk, result unknown
+    using ResultCallback = std::function<void(const Connection&, std::span<const PgResultEntry> results)>;
+
+    PgQueryParser(QueryCallback cb, ResultCallback on_result,
+                  ParserLimits limits = ParserLimits(), bool track_responses = true);
+
+    //  SQL text with parameters substituted, appended to out
+    static void render(const PgQuery& query, std::string& out);
+
+    //  Flat copy of a query for later render, appended to out
+    //  Packing is memcpy only, no literal formatting
+    static void pack(const PgQuery& query, std::string& out);
+    static void renderPacked(std::string_view packed, std::string& out);
+    static std::uint64_t packedFingerprint(std::string_view packed);
 
     //  Raw data from client
     void onClientData(Connection& conn, const char* data, std::size_t len);
 
-    //  Clean connections
-    void onConnectionClosed(const Connection& conn);
+    //  Raw data from server, only message headers of untracked replies are read
+    void onServerData(Connection& conn, const char* data, std::size_t len);
+
+    bool tracksResponses() const { return track_responses_; }
+
+    //  Message counters go to the owning reactor's slot, nullptr = off
+    void setMetrics(WorkerMetrics* metrics) { metrics_ = metrics; }
+
+    //  Clean connections, state goes back to pool
+    //  Queries still waiting for replies get an unknown result first
+    void onConnectionClosed(Connection& conn);
+
+    //  Parser memory of this worker, all links, any thread may read
+    std::size_t memoryBytes() const { return memory_bytes_.load(std::memory_order_relaxed); }
+    //  Most any single link has held
+    std::size_t peakLinkBytes() const { return peak_link_bytes_.load(std::memory_order_relaxed); }
+    //  Entries dropped by the cap, and Executes that needed one of them
+    std::uint64_t evictions() const { return evictions_.load(std::memory_order_relaxed); }
+    std::uint64_t evictedExecuted() const { return evicted_executed_.load(std::memory_order_relaxed); }
 
 private:
-    struct Statement {
-        std::string pg_template;
-        std::vector<std::uint32_t> param_types;
+    //  Larger buffers and maps are dropped on release instead of kept
+    static constexpr std::size_t kKeepBufBytes = 16 * 1024;
+    static constexpr std::size_t kKeepBuckets = 64;
+
+    //  Named arena is rebuilt once dead entries outweigh live ones by this much
+    static constexpr std::size_t kCompactSlack = 64 * 1024;
+
+    //  Evicted names remembered per link, the set starts over past this
+    static constexpr std::size_t kMaxEvictedNames = 4096;
+
+    //  Startup packet codes of encryption requests
+    static constexpr std::uint32_t kSslRequestCode = 80877103;
+    static constexpr std::uint32_t kGssEncRequestCode = 80877104;
+
+    //  Unanswered requests per link before tracking gives up on it
+    static constexpr std::size_t kMaxPending = 65536;
+    //  Answered entries dropped from the front of the queue in bulk
+    static constexpr std::size_t kPendingCompact = 256;
+
+    //  Recency list link of a named entry, unnamed ones are never linked
+    struct LruNode {
+        LruNode* prev = nullptr;
+        LruNode* next = nullptr;
+        std::string_view name;  //  Map key
+        std::size_t cost = 0;   //  Counted against max_bytes
+        bool is_portal = false;
     };
 
-    struct Portal {
-        std::string statement_name;
-        std::vector<std::string> param_values;
-        std::vector<std::uint16_t> param_formats;  //  0=text, 1=binary
+    //  Views and arrays below point into one of ConnState's arenas
+    struct Statement : LruNode {
+        TemplateIntern::Ref tmpl;  //  Shared text, not in arena
+        const std::uint32_t* param_types = nullptr;
+        std::uint16_t num_param_types = 0;
+        std::size_t bytes = 0;  //  Arena bytes, name included
     };
 
-    struct ConnState {
+    using Param = PgParam;
+
+    struct Portal : LruNode {
+        std::string_view statement_name;
+        const Param* params = nullptr;
+        std::uint16_t num_params = 0;
+        std::size_t bytes = 0;
+    };
+
+    //  Client request the server answers on its own, matched FIFO
+    struct Pending {
+        char kind = 0;  //  'Q', 'E', or 'S'/'F' answered by ReadyForQuery only
+        bool done = false;
+        std::int64_t start_ns = 0;
+        std::size_t record_off = 0;  //  Sink record in ConnState::records
+        std::size_t record_len = 0;
+        PgResult result;
+    };
+
+    struct ConnState : InterceptorState {
         std::string buf;  //  bytestream from client
         bool startup_skipped = false;
 
-        //  Wow, so unordered, such perfomance
-        std::unordered_map<std::string, Statement> statements;
-        std::unordered_map<std::string, Portal> portals;
+        //  Named statements and portals, keys live in named_arena too
+        //  Long-lived: survives many queries, rebuilt when closed entries pile up
+        Arena named_arena{4096, kKeepBufBytes};
+        std::size_t named_live_bytes = 0;
+        std::unordered_map<std::string_view, Statement> statements;
+        std::unordered_map<std::string_view, Portal> portals;
+
+        //  Named entries, least recently used first, lru itself is the sentinel
+        LruNode lru;
+        std::size_t lru_bytes = 0;
+        //  Name hashes of evicted entries, to tell eviction misses from client bugs
+        std::unordered_set<std::uint64_t> evicted;
+
+        //  Unnamed statement and portal are replaced nearly every query,
+        //  each has own arena, reset when it is replaced or dropped
+        Arena unnamed_statement_arena{4096, kKeepBufBytes};
+        Statement unnamed_statement;
+        bool unnamed_parsed = false;
+
+        Arena portal_arena{4096, kKeepBufBytes};
+        Portal unnamed_portal;
+        bool unnamed_bound = false;
+
+        //  Requests not fully answered, oldest at pending_head
+        std::vector<Pending> pending;
+        std::size_t pending_head = 0;
+        std::string records;
+
+        //  Server stream: a split header or tracked reply, never DataRow payload
+        std::string server_buf;
+        std::size_t server_skip = 0;  //  Rest of an untracked reply still to pass
+        bool ssl_requested = false;   //  Server answers with one unframed byte
+        bool encrypted = false;       //  TLS/GSS accepted, nothing to parse
+        bool server_lost = false;     //  Replies can not be matched anymore
+
+        std::size_t accounted_bytes = 0;  //  This link's share of memory_bytes_
+
+        ConnState() { lru.prev = lru.next = &lru; }
     };
 
     QueryCallback callback_;
-    std::unordered_map<const Connection*, ConnState> states_;
+    ResultCallback result_;
+    ParserLimits limits_;
+    bool track_responses_;
+
+    WorkerMetrics* metrics_ = nullptr;
+
+    std::string record_;  //  Sink records when responses are not tracked
+
+    //  Finished queries of the current call, by offset into their record buffer
+    struct Finished {
+        std::size_t off;
+        std::size_t len;
+        PgResult result;
+    };
+    std::vector<Finished> finished_;
+    std::vector<PgResultEntry> batch_;
+    std::int64_t now_ns_ = 0;  //  Arrival time of the data being parsed
+
+    //  Pool of per-connection states, reused on next connection
+    std::vector<std::unique_ptr<ConnState>> states_;
+    std::vector<ConnState*> free_states_;
+
+    //  Written by owning worker only, read by stats
+    std::atomic<std::size_t> memory_bytes_{0};
+    std::atomic<std::size_t> peak_link_bytes_{0};
+    std::atomic<std::uint64_t> evictions_{0};
+    std::atomic<std::uint64_t> evicted_executed_{0};
 
     ConnState& stateFor(Connection& conn);
+    void account(ConnState& st);
+    static std::size_t stateBytes(const ConnState& st);
+
+    //  Parser state storage
+    static Statement* findStatement(ConnState& st, std::string_view name);
+    static Statement makeStatement(Arena& arena, TemplateIntern::Ref tmpl, const char* types, std::uint16_t ntypes);
+    static TemplateIntern::Ref internTemplate(std::string_view query, Statement* previous);
+    static void dropNamedStatement(ConnState& st, std::string_view name);
+    static void dropNamedPortal(ConnState& st, std::string_view name);
+    static void compactNamed(ConnState& st);
+
+    //  Recency list and cap
+    static void lruLink(ConnState& st, LruNode* node);
+    static void lruUnlink(ConnState& st, LruNode* node);
+    static void lruTouch(ConnState& st, LruNode* node);
+    static std::uint64_t evictedKey(bool is_portal, std::string_view name);
+    void enforceLimits(ConnState& st, const LruNode* keep);
+    void noteMiss(ConnState& st, bool is_portal, std::string_view name);
+
+    //  Request/reply matching
+    static std::int64_t nowNs();
+    bool tracking(const ConnState& st) const { return track_responses_ && !st.server_lost; }
+    void pushRequest(const Connection& conn, ConnState& st, char kind);
+    void emitQuery(const Connection& conn, ConnState& st, const PgQuery& query);
+    void flushResults(const Connection& conn, ConnState& st, bool all);
+    void emitResults(const Connection& conn, std::string_view records);
+    void loseServer(const Connection& conn, ConnState& st);
+    static bool isTrackedReply(char type);
+    std::size_t processServerBuffer(Connection& conn, ConnState& st, const char* data, std::size_t size);
+    void handleServerMessage(ConnState& st, const char* msg, std::size_t total_len);
+    static std::int64_t commandRows(std::string_view tag);
+
+    void countMessage(WorkerMetrics::MessageType type) {
+        if (metrics_) WorkerMetrics::add(metrics_->messages[type]);
+    }
 
     //  Parser functional
-    void processBuffer(Connection& conn, ConnState& st);
+    std::size_t processBuffer(Connection& conn, ConnState& st, const char* data, std::size_t size);
     void handleSimpleQuery(Connection& conn, ConnState& st, const char* msg, std::size_t total_len);
     void handleParse(Connection& conn, ConnState& st, const char* msg, std::size_t total_len);
     void handleBind(Connection& conn, ConnState& st, const char* msg, std::size_t total_len);
@@ -59,13 +280,14 @@ private:
 
     static bool isIntegerLiteral(std::string_view s);
     static bool isFloatLiteral(std::string_view s);
-    static std::string formatByteaLiteral(const std::string& value);
-    static std::string formatStringLiteral(const std::string& value);
+    static void appendByteaLiteral(std::string& out, std::string_view value);
+    static void appendStringLiteral(std::string& out, std::string_view value);
 
     static std::uint32_t be32(const char* p);
     static std::uint16_t be16(const char* p);
 
-    static std::string readCString(const char* msg, std::size_t total_len, std::size_t& pos);
-    static std::string makeupPreparedQuery(const Statement& stmt, const Portal& portal);
-    static std::string formatParamForSql(const std::string& value, std::uint16_t format_code);
+    static std::string_view readCString(const char* msg, std::size_t total_len, std::size_t& pos);
+    template <typename ParamAt>
+    static void makeupPreparedQuery(std::string_view tmpl, std::size_t num_params, ParamAt param_at, std::string& out);
+    static void appendParamForSql(std::string& out, const Param& param);
 };
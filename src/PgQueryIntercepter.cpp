@@ -1,18 +1,150 @@
 #include "PgQueryInterceptor.h"
 
-PgQueryInterceptor::PgQueryInterceptor(Logger* logger)
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+
+PgQueryInterceptor::PgQueryInterceptor(Logger* logger, ParserLimits limits, SamplingOptions sampling,
+                                       bool track_responses)
     : p_logger_(logger)
-    , parser_([this](const Connection& conn, const std::string& pg_query) {
-        if (p_logger_) {
-            std::string message = conn.client_addr;
-            message += " ";
-            message += pg_query;
-            p_logger_->write(message);
-        }
-    })
+    , sampling_(sampling)
+    , burst_(std::max(1.0, sampling.fingerprint_rate))
+    , parser_(
+        //  Record waits in the parser for the reply: | u8 prepared | u32 addr_len | addr | text or packed |
+        [this](const Connection& conn, const PgQuery& query, std::string& record) {
+            if (!p_logger_ || !admit(query)) return;
+
+            std::uint8_t prepared = query.prepared ? 1 : 0;
+            std::uint32_t addr_len = static_cast<std::uint32_t>(conn.client_addr.size());
+            record.append(reinterpret_cast<const char*>(&prepared), sizeof(prepared));
+            record.append(reinterpret_cast<const char*>(&addr_len), sizeof(addr_len));
+            record += conn.client_addr;
+
+            //  Prepared one is packed, $n substitution happens in logger
+            if (query.prepared) {
+                PgQueryParser::pack(query, record);
+            } else {
+                record += query.text;
+            }
+        },
+        //  Result goes in front of each record, the whole batch is one logger call
+        [this](const Connection&, std::span<const PgResultEntry> results) {
+            message_.clear();
+            ends_.clear();
+            for (const PgResultEntry& entry : results) {
+                const PgResult& result = entry.result;
+                //  Unknown duration = link closed while waiting, kept as possibly slow
+                bool fast = result.skipped || (result.duration_ns >= 0 && result.duration_ns < sampling_.slow_ns);
+                if (sampling_.slow_ns > 0 && fast) {
+                    sampled_out_.store(sampled_out_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+                    continue;
+                }
+                message_.append(reinterpret_cast<const char*>(&result), sizeof(result));
+                message_ += entry.record;
+                ends_.push_back(message_.size());
+            }
+            if (ends_.empty()) return;
+
+            //  Views only after message_ stopped growing
+            views_.clear();
+            std::size_t start = 0;
+            for (std::size_t end : ends_) {
+                views_.emplace_back(message_.data() + start, end - start);
+                start = end;
+            }
+            p_logger_->write(std::span<const std::string_view>(views_), &PgQueryInterceptor::renderLine);
+        },
+        limits, track_responses)
 {}
 
+//  | PgResult | record | -> "addr [fp=<template fingerprint>] [dur=..ms] [rows=N] [err=SQLSTATE] query"
+void PgQueryInterceptor::renderLine(std::string_view packed, std::string& out) {
+    PgResult result;
+    std::uint8_t prepared = 0;
+    std::uint32_t addr_len = 0;
+    if (packed.size() < sizeof(result) + sizeof(prepared) + sizeof(addr_len)) return;
+    std::memcpy(&result, packed.data(), sizeof(result));
+    packed.remove_prefix(sizeof(result));
+    std::memcpy(&prepared, packed.data(), sizeof(prepared));
+    packed.remove_prefix(sizeof(prepared));
+    std::memcpy(&addr_len, packed.data(), sizeof(addr_len));
+    packed.remove_prefix(sizeof(addr_len));
+
+    out += packed.substr(0, addr_len);
+    packed.remove_prefix(std::min<std::size_t>(addr_len, packed.size()));
+
+    char meta[96];
+    int n = 0;
+    if (prepared) {
+        n += std::snprintf(meta + n, sizeof(meta) - n, " fp=%016llx",
+                           static_cast<unsigned long long>(PgQueryParser::packedFingerprint(packed)));
+    }
+    if (result.duration_ns >= 0) {
+        n += std::snprintf(meta + n, sizeof(meta) - n, " dur=%.3fms", result.duration_ns / 1e6);
+    }
+    if (result.rows >= 0) {
+        n += std::snprintf(meta + n, sizeof(meta) - n, " rows=%lld", static_cast<long long>(result.rows));
+    }
+    if (result.skipped) {
+        n += std::snprintf(meta + n, sizeof(meta) - n, " err=skipped");
+    } else if (result.sqlstate[0]) {
+        n += std::snprintf(meta + n, sizeof(meta) - n, " err=%.5s", result.sqlstate);
+    }
+    out.append(meta, static_cast<std::size_t>(n));
+    out += ' ';
+
+    if (prepared) {
+        PgQueryParser::renderPacked(packed, out);
+    } else {
+        out += packed;
+    }
+}
+
+//  Counter and one bucket lookup, skipped queries are never packed or rendered
+bool PgQueryInterceptor::admit(const PgQuery& query) {
+    if (sampling_.one_in > 1) {
+        if (skip_left_ > 0) {
+            skip_left_--;
+            sampled_out_.store(sampled_out_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            return false;
+        }
+        skip_left_ = sampling_.one_in - 1;
+    }
+
+    if (sampling_.fingerprint_rate <= 0) return true;
+
+    //  Simple queries have no template, their literal text is the key
+    std::uint64_t fp = query.prepared ? query.fingerprint : TemplateIntern::fingerprint(query.text);
+    std::int64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+
+    if (buckets_.size() >= kMaxBuckets && !buckets_.count(fp)) {
+        buckets_.clear();
+    }
+    auto [it, inserted] = buckets_.try_emplace(fp, Bucket{burst_, now});
+    Bucket& bucket = it->second;
+    if (!inserted) {
+        bucket.tokens = std::min(burst_, bucket.tokens + (now - bucket.last_ns) * sampling_.fingerprint_rate / 1e9);
+        bucket.last_ns = now;
+    }
+
+    if (bucket.tokens < 1) {
+        sampled_out_.store(sampled_out_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        return false;
+    }
+    bucket.tokens -= 1;
+    return true;
+}
+
 void PgQueryInterceptor::onClientData(Connection& conn, const char* data, std::size_t len) {
     parser_.onClientData(conn, data, len);
 }
 
+void PgQueryInterceptor::onServerData(Connection& conn, const char* data, std::size_t len) {
+    parser_.onServerData(conn, data, len);
+}
+
+void PgQueryInterceptor::onConnectionClosed(Connection& conn) {
+    parser_.onConnectionClosed(conn);
+}
@@ -1,21 +1,76 @@
 #pragma once
 
+#include <atomic>
+#include <cstdint>
 #include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
 
 #include "ProtocolInterceptor.h"
 #include "PgParser.h"
 #include "Logger.h"
 
+//  Which queries reach the log, decided before packing or formatting
+//  Both policies on: a query is logged only if it passes both
+struct SamplingOptions {
+    std::uint32_t one_in = 1;     //  Every Nth query, 1 = all
+    double fingerprint_rate = 0;  //  Per statement text, queries/s of this worker, 0 = no limit
+    std::int64_t slow_ns = 0;     //  Only queries that took at least this, needs response tracking
+};
+
 //  Get stream -> parse stream -> log stream
 
 class PgQueryInterceptor : public IProtocolInterceptor {
 public:
-    explicit PgQueryInterceptor(Logger* logger);
+    explicit PgQueryInterceptor(Logger* logger, ParserLimits limits = ParserLimits(),
+                                SamplingOptions sampling = SamplingOptions(), bool track_responses = true);
 
     // Client -> Server
     void onClientData(Connection& conn, const char* data, std::size_t len) override;
 
+    // Server -> Client, replies give duration, rows and errors of queries
+    void onServerData(Connection& conn, const char* data, std::size_t len) override;
+    bool needsServerData() const override { return parser_.tracksResponses(); }
+
+    //  Reactor's metrics slot, set before the reactor runs
+    void setMetrics(WorkerMetrics* metrics) { parser_.setMetrics(metrics); }
+
+    void onConnectionClosed(Connection& conn) override;
+
+    //  Parser memory stats, safe from any thread
+    std::size_t parserBytes() const { return parser_.memoryBytes(); }
+    std::size_t parserPeakLinkBytes() const { return parser_.peakLinkBytes(); }
+    std::uint64_t parserEvictions() const { return parser_.evictions(); }
+    std::uint64_t parserEvictedExecuted() const { return parser_.evictedExecuted(); }
+
+    //  Queries not logged by sampling, safe from any thread
+    std::uint64_t sampledOut() const { return sampled_out_.load(std::memory_order_relaxed); }
+
 private:
+    //  Buckets are dropped all at once past this, a burst of new texts starts full
+    static constexpr std::size_t kMaxBuckets = 65536;
+
+    struct Bucket {
+        double tokens = 0;
+        std::int64_t last_ns = 0;
+    };
+
     Logger* p_logger_ = nullptr;
+    std::string message_;  //  Result + record per query of a batch, reused between batches
+    std::vector<std::size_t> ends_;
+    std::vector<std::string_view> views_;
+
+    //  Owning worker only, no locking
+    SamplingOptions sampling_;
+    double burst_ = 1;
+    std::uint32_t skip_left_ = 0;
+    std::unordered_map<std::uint64_t, Bucket> buckets_;
+    std::atomic<std::uint64_t> sampled_out_{0};
+
     PgQueryParser parser_;
+
+    bool admit(const PgQuery& query);
+
+    static void renderLine(std::string_view packed, std::string& out);
 };
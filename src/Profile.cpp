@@ -0,0 +1,100 @@
+#include "Profile.h"
+
+#ifdef PG_PROXY_PROFILE
+
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <thread>
+#include <vector>
+
+#include "Histogram.h"
+
+namespace profile {
+
+namespace {
+
+struct ThreadStages {
+    std::array<LatencyHistogram, kStages> stages;
+};
+
+//  Sets outlive their threads, a dump after a worker exits still reads them
+struct Registry {
+    std::mutex mutex;
+    std::vector<std::unique_ptr<ThreadStages>> threads;
+};
+
+Registry& registry() {
+    static Registry instance;
+    return instance;
+}
+
+ThreadStages* registerThread() {
+    Registry& reg = registry();
+    std::lock_guard<std::mutex> lock(reg.mutex);
+    reg.threads.push_back(std::make_unique<ThreadStages>());
+    return reg.threads.back().get();
+}
+
+const char* const kStageNames[kStages] = {
+    "recv", "intercept_client", "intercept_server", "process_buffer",
+    "render", "log_write", "log_flush", "send",
+};
+
+//  Ticks per ns against the steady clock, over a short sleep
+double ticksPerNs() {
+    auto wall_start = std::chrono::steady_clock::now();
+    std::uint64_t tick_start = ticks();
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    std::uint64_t tick_end = ticks();
+    auto wall_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - wall_start).count();
+    return wall_ns > 0 ? static_cast<double>(tick_end - tick_start) / static_cast<double>(wall_ns) : 1.0;
+}
+
+}  // namespace
+
+void record(Stage stage, std::uint64_t elapsed_ticks) {
+    static thread_local ThreadStages* mine = nullptr;
+    if (!mine) mine = registerThread();
+    mine->stages[stage].record(elapsed_ticks);
+}
+
+void dump(std::ostream& out) {
+    std::vector<LatencyHistogram::Snapshot> merged(kStages);
+    {
+        Registry& reg = registry();
+        std::lock_guard<std::mutex> lock(reg.mutex);
+        for (const auto& thread : reg.threads) {
+            for (int s = 0; s < kStages; s++) {
+                thread->stages[s].addTo(merged[s]);
+            }
+        }
+    }
+
+    double per_ns = ticksPerNs();
+    auto ns = [per_ns](std::uint64_t t) { return static_cast<double>(t) / per_ns; };
+
+    char line[160];
+    std::snprintf(line, sizeof(line), "Profile: %-17s %12s %10s %10s %10s %10s %10s %10s\n",
+                  "stage", "count", "mean_ns", "p50_ns", "p90_ns", "p99_ns", "p999_ns", "max_ns");
+    out << line;
+    for (int s = 0; s < kStages; s++) {
+        const LatencyHistogram::Snapshot& h = merged[s];
+        if (h.total == 0) continue;
+        std::snprintf(line, sizeof(line), "Profile: %-17s %12llu %10.0f %10.0f %10.0f %10.0f %10.0f %10.0f\n",
+                      kStageNames[s], static_cast<unsigned long long>(h.total),
+                      ns(h.sum) / static_cast<double>(h.total),
+                      ns(h.quantile(0.5)), ns(h.quantile(0.9)), ns(h.quantile(0.99)),
+                      ns(h.quantile(0.999)), ns(h.quantile(1.0)));
+        out << line;
+    }
+    out.flush();
+}
+
+}  // namespace profile
+
+#endif
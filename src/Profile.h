@@ -0,0 +1,75 @@
+#pragma once
+
+//  PROFILE=1 build: time of each hot path stage into per-thread histograms,
+//  dumped to stderr on SIGUSR1. Otherwise PROFILE_SCOPE compiles to nothing
+
+#include <cstdint>
+#include <iosfwd>
+
+namespace profile {
+
+enum Stage {
+    kRecv,             //  recv() into the link ring buffer
+    kInterceptClient,  //  Interceptor onClientData
+    kInterceptServer,  //  Interceptor onServerData
+    kProcessBuffer,    //  Parser walk over client messages
+    kRender,           //  $n substitution and literal formatting
+    kLogWrite,         //  Logger::write, render + lock or enqueue
+    kLogFlush,         //  writev() to the log file
+    kSend,             //  Flush of a link ring buffer to its socket
+    kStages
+};
+
+}  // namespace profile
+
+#ifdef PG_PROXY_PROFILE
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#else
+#include <ctime>
+#endif
+
+namespace profile {
+
+//  TSC where there is one, converted to ns at dump time
+inline std::uint64_t ticks() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<std::uint64_t>(ts.tv_sec) * 1000000000ull + static_cast<std::uint64_t>(ts.tv_nsec);
+#endif
+}
+
+//  Into the calling thread's own histograms, no sharing on the hot path
+void record(Stage stage, std::uint64_t elapsed_ticks);
+
+//  Merges all threads, one line per stage
+void dump(std::ostream& out);
+
+class Scope {
+public:
+    explicit Scope(Stage stage) : stage_(stage), start_(ticks()) {}
+    ~Scope() { record(stage_, ticks() - start_); }
+
+    Scope(const Scope&) = delete;
+    Scope& operator=(const Scope&) = delete;
+
+private:
+    Stage stage_;
+    std::uint64_t start_;
+};
+
+}  // namespace profile
+
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+#define PROFILE_SCOPE(stage) ::profile::Scope PROFILE_CONCAT(profile_scope_, __LINE__)(::profile::stage)
+
+#else
+
+#define PROFILE_SCOPE(stage) static_cast<void>(0)
+
+#endif
@@ -13,4 +13,14 @@ public:
         (void)data;
         (void)len;
     }
+
+    // Link is gone, per-connection state must be released here
+    virtual void onConnectionClosed(Connection& conn) {
+        (void)conn;
+    }
+
+    // True if onServerData does real work, turns off splice() pass-through
+    virtual bool needsServerData() const { return false; }
+
+    virtual ~IProtocolInterceptor() = default;
 };
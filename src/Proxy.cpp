@@ -1,5 +1,20 @@
 #include "Proxy.h"
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "Profile.h"
+
+//  Shared between workers, so ids stay unique across reactors
+static std::atomic<int> next_connection_id{1};
+
+int Proxy::next_id() {
+    return next_connection_id.fetch_add(1, std::memory_order_relaxed);
+}
+
 //  Set new flag for nonblocking mode 
 static bool set_nonblocking(int fd) {
     int flags = fcntl(fd, F_GETFL, 0);
@@ -8,32 +23,26 @@ static bool set_nonblocking(int fd) {
     return true;
 }
 
-//  move data from buffer to socket
-static int flush_buffer(int fd, std::string& buf) {
-    while (!buf.empty()) {
-        ssize_t n = ::send(fd, buf.data(), buf.size(), 0);
-
-        if (n > 0) {
-            buf.erase(0, static_cast<size_t>(n));
-            continue;
-        }
-
-        if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
-            return 0; // socket not ready
-        }
-
-        return -1;  // error 
-    }
-
-    return 0;
+//  Forwarded replies are written in pieces, Nagle would hold the tail for a delayed ACK
+static void set_nodelay(int fd) {
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
 }
 
-
-Proxy::Proxy(std::string& lst_host, uint16_t lst_port, std::string& dbs_host, uint16_t dbs_port)  
+Proxy::Proxy(std::string& lst_host, uint16_t lst_port, std::string& dbs_host, uint16_t dbs_port,
+             const ProxyOptions& options)
     : lst_host_(lst_host)
     , lst_port_(lst_port)
     , dbs_host_(dbs_host)
-    , dbs_port_(dbs_port) {}
+    , dbs_port_(dbs_port)
+    , options_(options) {
+
+    std::size_t cap = options_.buffer_size;
+    c2s_high_ = (options_.c2s_high && options_.c2s_high < cap) ? options_.c2s_high : cap;
+    s2c_high_ = (options_.s2c_high && options_.s2c_high < cap) ? options_.s2c_high : cap;
+    c2s_low_  = (options_.c2s_low && options_.c2s_low < c2s_high_) ? options_.c2s_low : c2s_high_ / 2;
+    s2c_low_  = (options_.s2c_low && options_.s2c_low < s2c_high_) ? options_.s2c_low : s2c_high_ / 2;
+}
 
 bool Proxy::setup_listener() {
 
@@ -45,6 +54,11 @@ bool Proxy::setup_listener() {
     int enable = 1;
     if (setsockopt(listener_fd_, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable)) == -1) return false;
 
+    //  Every worker binds its own listener on the same port, kernel spreads accepts
+    if (options_.reuse_port) {
+        if (setsockopt(listener_fd_, SOL_SOCKET, SO_REUSEPORT, &enable, sizeof(enable)) == -1) return false;
+    }
+
     //  Prepare addr before bind
     sockaddr_in addr{};
     addr.sin_family = AF_INET;
@@ -60,7 +74,7 @@ bool Proxy::setup_listener() {
     //  To make listener listen, server case
     if (listen(listener_fd_, SOMAXCONN) == -1) return false;
     
-    std::cout << "LISTEN: " << lst_host_ << ":" << lst_port_ << "\n"
+    std::cout << "LISTEN: " << lst_host_ << ":" << lst_port_ << " worker=" << options_.worker_id << "\n"
               << "FRWARD: " << dbs_host_ << ":" << dbs_port_ << "\n";
 
     return true;
@@ -70,14 +84,19 @@ bool Proxy::setup_epoll() {
     epoll_fd_ = epoll_create1(0);
     if (epoll_fd_ == -1) return false;
     
-    FdContext listener_context;
-    listener_context.role = FdRole::LISTENER;
-    listener_context.conn = nullptr;
-
-    fd_context_map_[listener_fd_] = listener_context;
+    register_fd(listener_fd_, nullptr, FdRole::LISTENER);
 
     //  Event when client sends data to proxy
-    if (!add_fd_to_epoll(listener_fd_, &fd_context_map_[listener_fd_], EPOLLIN)) {
+    if (!add_fd_to_epoll(listener_fd_, EPOLLIN)) {
+        return false;
+    }
+
+    //  Stop requests from other threads
+    wakeup_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wakeup_fd_ == -1) return false;
+
+    register_fd(wakeup_fd_, nullptr, FdRole::WAKEUP);
+    if (!add_fd_to_epoll(wakeup_fd_, EPOLLIN)) {
         return false;
     }
 
@@ -87,50 +106,162 @@ bool Proxy::setup_epoll() {
 bool Proxy::init() {
     if (!setup_listener()) return false;
     if (!setup_epoll()) return false;
+
+    //  Parsed once, every connect of every reactor backend uses it
+    db_addr_.sin_family = AF_INET;
+    db_addr_.sin_port = htons(dbs_port_);
+    if (inet_pton(AF_INET, dbs_host_.c_str(), &db_addr_.sin_addr) <= 0) return false;
+    if (options_.pool_size > 0 && !pool_init()) return false;
+
+    //  Interceptor that reads server data needs bytes in user space
+    splice_active_ = options_.splice && !(interceptor_ && interceptor_->needsServerData());
+    if (options_.splice && !splice_active_) {
+        std::cout << "SPLICE: off, interceptor needs server data\n";
+    }
     return true;
 }
 
+//  Non-blocking connect to the address parsed in init(), -1 on failure
 int Proxy::connect_to_db() {
-    //  IPv4 TCP default fd init
-    int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+    int fd = ::socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
     if (fd == -1) return -1;
+    set_nodelay(fd);
 
     //  Close in case of error is neccessary, cause fd amount can be huge
     //  And we don't want dead fd 
-
-    if (!set_nonblocking(fd)) {
+    int res = ::connect(fd, reinterpret_cast<sockaddr*>(&db_addr_), sizeof(db_addr_));
+    if (res == -1 && errno != EINPROGRESS) {
         close(fd);
         return -1;
     }
 
-    //  Prepare addr before connect
-    sockaddr_in addr{};
-    addr.sin_family = AF_INET;
-    addr.sin_port = htons(dbs_port_);
-    if (inet_pton(AF_INET, dbs_host_.c_str(), &addr.sin_addr) <= 0) {
+    return fd;
+}
+
+std::int64_t Proxy::now_ms() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+//  Start connects up to the target, as fast as the refill rate allows
+void Proxy::warm_fill() {
+    std::size_t target = options_.prewarm;
+    if (warm_ready_.size() + warm_connecting_ >= target) return;
+
+    //  Token bucket, a burst of at most one second's worth
+    std::int64_t now = now_ms();
+    double rate = options_.prewarm_rate;
+    warm_tokens_ = std::min(rate, warm_tokens_ + static_cast<double>(now - warm_refill_ms_) * rate / 1000.0);
+    warm_refill_ms_ = now;
+
+    while (warm_ready_.size() + warm_connecting_ < target && warm_tokens_ >= 1.0) {
+        warm_tokens_ -= 1.0;
+        int fd = connect_to_db();
+        if (fd == -1) {
+            perror("prewarm connect");
+            return;
+        }
+        register_fd(fd, nullptr, FdRole::WARM);
+        add_fd_to_epoll(fd, EPOLLOUT | EPOLLRDHUP);
+        warm_connecting_++;
+    }
+}
+
+//  Connect finished, or a ready socket heard from the server before any startup:
+//  that is only ever a close (e.g. authentication_timeout), so it is dropped
+void Proxy::handle_warm_event(int fd, uint32_t events) {
+    auto ready = std::find_if(warm_ready_.begin(), warm_ready_.end(),
+                              [fd](const WarmSocket& warm) { return warm.fd == fd; });
+    bool connecting = ready == warm_ready_.end();
+
+    int err = 0;
+    socklen_t err_len = sizeof(err);
+    bool healthy = connecting && !(events & (EPOLLHUP | EPOLLERR | EPOLLRDHUP | EPOLLIN))
+                && getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &err_len) == 0 && err == 0;
+
+    if (connecting) warm_connecting_--;
+    if (!healthy) {
+        if (!connecting) warm_ready_.erase(ready);
+        epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, fd, nullptr);
         close(fd);
-        return -1;
+        unregister_fd(fd);
+        return;
     }
 
-    
-    int res = ::connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr));
-    if (res == -1 && errno != EINPROGRESS) {
+    warm_ready_.push_back(WarmSocket{ fd, now_ms() });
+    update_epoll_events(fd, true, false);
+}
+
+//  Freshest ready socket, -1 when none; a final peek catches a close not seen yet
+int Proxy::warm_take() {
+    while (!warm_ready_.empty()) {
+        int fd = warm_ready_.back().fd;
+        warm_ready_.pop_back();
+
+        epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, fd, nullptr);
+        unregister_fd(fd);
+
+        char probe;
+        ssize_t n = ::recv(fd, &probe, 1, MSG_PEEK | MSG_DONTWAIT);
+        if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            if (options_.metrics) WorkerMetrics::add(options_.metrics->connects_warm);
+            return fd;
+        }
         close(fd);
-        return -1;
     }
+    return -1;
+}
 
-    return fd;
+//  Ready sockets past kWarmMaxAgeMs are replaced before the server times them out
+void Proxy::warm_expire() {
+    std::int64_t oldest_allowed = now_ms() - kWarmMaxAgeMs;
+    while (!warm_ready_.empty() && warm_ready_.front().since_ms < oldest_allowed) {
+        int fd = warm_ready_.front().fd;
+        warm_ready_.pop_front();
+        epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, fd, nullptr);
+        close(fd);
+        unregister_fd(fd);
+    }
+}
+
+//  epoll_wait timeout: next token while short of target, next expiry otherwise
+int Proxy::warm_timeout(int timeout) const {
+    std::int64_t wait = -1;
+    if (warm_ready_.size() + warm_connecting_ < options_.prewarm && options_.prewarm_rate > 0) {
+        wait = static_cast<std::int64_t>(std::max(0.0, (1.0 - warm_tokens_) * 1000.0 / options_.prewarm_rate)) + 1;
+    }
+    if (!warm_ready_.empty()) {
+        std::int64_t expiry = std::max<std::int64_t>(warm_ready_.front().since_ms + kWarmMaxAgeMs - now_ms(), 0);
+        wait = wait == -1 ? expiry : std::min(wait, expiry);
+    }
+    if (wait == -1) return timeout;
+    return timeout == -1 ? static_cast<int>(wait) : std::min(timeout, static_cast<int>(wait));
 }
 
 void Proxy::close_connection(Connection* conn) {
     if (!conn || conn->closed) return;
     conn->closed = true;
+    if (options_.metrics) WorkerMetrics::add(options_.metrics->closed);
+
+    //  Lent backend is dropped with the client, a waiting one leaves the queue
+    if (options_.pool_size > 0) pool_client_closed(conn);
+
+    //  Buffered bytes die with the link
+    if (options_.budget) {
+        options_.budget->refund(conn->client_out.size() + conn->server_out.size() + conn->pipe_bytes);
+    }
+
+    //  Parser state goes back to interceptor now, not at some later time
+    if (interceptor_) {
+        interceptor_->onConnectionClosed(*conn);
+    }
+    conn->interceptor_state = nullptr;
 
     //  Close client
     if (conn->client_fd != -1) {
         epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, conn->client_fd, nullptr);
         close(conn->client_fd);
-        fd_context_map_.erase(conn->client_fd);
+        unregister_fd(conn->client_fd);
         conn->client_fd = -1;
     }
 
@@ -138,33 +269,284 @@ void Proxy::close_connection(Connection* conn) {
     if (conn->server_fd != -1) {
         epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, conn->server_fd, nullptr);
         close(conn->server_fd);
-        fd_context_map_.erase(conn->server_fd);
+        unregister_fd(conn->server_fd);
         conn->server_fd = -1;
     }
+
+    //  Close splice pipe
+    if (conn->pipe_r != -1) {
+        close(conn->pipe_r);
+        close(conn->pipe_w);
+        conn->pipe_r = conn->pipe_w = -1;
+        conn->pipe_bytes = 0;
+    }
+
+    //  Events of this batch may still point here, reuse waits till batch end
+    closed_connections_.push_back(conn);
+}
+
+Connection* Proxy::acquire_connection() {
+    if (free_connections_.empty()) {
+        connections_.push_back(std::make_unique<Connection>());
+        return connections_.back().get();
+    }
+
+    Connection* conn = free_connections_.back();
+    free_connections_.pop_back();
+    pooled_buffer_bytes_ -= conn->client_out.allocatedBytes() + conn->server_out.allocatedBytes();
+    return conn;
+}
+
+//  O(1) per link: reset fields, keep ring storage while pool is under its cap
+void Proxy::reclaim_closed_connections() {
+    for (Connection* conn : closed_connections_) {
+        if (conn->budget_wait) {
+            budget_waiters_.erase(std::find(budget_waiters_.begin(), budget_waiters_.end(), conn));
+        }
+
+        conn->client_out.clear();
+        conn->server_out.clear();
+
+        std::size_t held = conn->client_out.allocatedBytes() + conn->server_out.allocatedBytes();
+        if (pooled_buffer_bytes_ + held > options_.pool_keep_bytes) {
+            conn->client_out.release();
+            conn->server_out.release();
+            held = 0;
+        }
+        pooled_buffer_bytes_ += held;
+
+        conn->client_addr.clear();
+        conn->server_addr.clear();
+        conn->pipe_capacity = 0;
+        conn->client_paused = false;
+        conn->server_paused = false;
+        conn->budget_wait = false;
+        conn->client_readable = conn->server_readable = false;
+        conn->client_writable = conn->server_writable = false;
+        conn->pool_phase = Connection::PoolPhase::Startup;
+        conn->pool_in.clear();
+        conn->prepared.clear();
+        conn->closed = false;
+
+        free_connections_.push_back(conn);
+    }
+    closed_connections_.clear();
+}
+
+bool Proxy::open_splice_pipe(Connection* conn) {
+    int fds[2];
+    if (pipe2(fds, O_NONBLOCK | O_CLOEXEC) == -1) return false;
+
+    if (options_.pipe_size > 0) {
+        fcntl(fds[1], F_SETPIPE_SZ, static_cast<int>(options_.pipe_size));  //  Best effort
+    }
+
+    int capacity = fcntl(fds[1], F_GETPIPE_SZ);
+    conn->pipe_r = fds[0];
+    conn->pipe_w = fds[1];
+    conn->pipe_bytes = 0;
+    conn->pipe_capacity = capacity > 0 ? static_cast<std::size_t>(capacity) : 65536;
+    return true;
+}
+
+//  server socket -> pipe -> client socket, bytes never reach user space
+//  Returns bytes moved (both hops), -1 when link must be closed
+ssize_t Proxy::splice_server_to_client(Connection* conn) {
+    const unsigned flags = SPLICE_F_MOVE | SPLICE_F_NONBLOCK;
+    ssize_t moved = 0;
+
+    while (true) {
+        //  Drain pipe first, whatever client socket accepts
+        while (conn->pipe_bytes > 0) {
+            ssize_t n = ::splice(conn->pipe_r, nullptr, conn->client_fd, nullptr, conn->pipe_bytes, flags);
+            if (n > 0) {
+                conn->pipe_bytes -= static_cast<std::size_t>(n);
+                if (options_.budget) options_.budget->refund(static_cast<std::size_t>(n));
+                moved += n;
+                continue;
+            }
+            if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                conn->client_writable = false;
+                break;
+            }
+            return -1;
+        }
+
+        //  Over high mark or budget, wait for client EPOLLOUT
+        std::size_t room = read_room(conn, false);
+        if (room == 0) return moved;
+
+        ssize_t n = ::splice(conn->server_fd, nullptr, conn->pipe_w, nullptr, room, flags);
+        if (n > 0) {
+            conn->pipe_bytes += static_cast<std::size_t>(n);
+            if (options_.metrics) WorkerMetrics::add(options_.metrics->bytes_s2c, static_cast<std::uint64_t>(n));
+            if (options_.budget) options_.budget->charge(static_cast<std::size_t>(n));
+            moved += n;
+            continue;
+        }
+
+        if (n == 0) {
+            std::cerr << "Received EOF on fd=" << conn->server_fd << " role=server\n";
+            return -1;
+        }
+
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            conn->server_readable = false;
+            return moved;
+        }
+
+        perror("splice");
+        return -1;
+    }
+}
+
+bool Proxy::client_wants_write(const Connection* conn) const {
+    return !conn->client_out.empty() || conn->pipe_bytes > 0;
+}
+
+std::size_t Proxy::s2c_buffered(const Connection* conn) const {
+    return conn->pipe_r != -1 ? conn->pipe_bytes : conn->client_out.size();
 }
 
-bool Proxy::add_fd_to_epoll(int fd, FdContext* context, uint32_t events) {
+std::size_t Proxy::s2c_high(const Connection* conn) const {
+    return conn->pipe_r != -1 ? std::min(s2c_high_, conn->pipe_capacity) : s2c_high_;
+}
+
+//  Hysteresis: pause a side at high mark, resume it only at low mark
+void Proxy::update_backpressure(Connection* conn) {
+    std::size_t c2s = conn->server_out.size();
+    if (conn->client_paused ? c2s <= c2s_low_ : c2s >= c2s_high_) {
+        conn->client_paused = !conn->client_paused;
+    }
+
+    std::size_t s2c = s2c_buffered(conn);
+    std::size_t high = s2c_high(conn);
+    std::size_t low = s2c_low_ < high ? s2c_low_ : high / 2;
+    if (conn->server_paused ? s2c <= low : s2c >= high) {
+        conn->server_paused = !conn->server_paused;
+    }
+}
+
+//  Bytes one more read from this side may take, 0 = stop reading
+std::size_t Proxy::read_room(Connection* conn, bool from_client) {
+    update_backpressure(conn);
+
+    if (from_client ? conn->client_paused : conn->server_paused) return 0;
+    if (conn->budget_wait) return 0;
+
+    std::size_t room = from_client ? c2s_high_ - conn->server_out.size()
+                                   : s2c_high(conn) - s2c_buffered(conn);
+
+    if (options_.budget) {
+        std::size_t avail = options_.budget->available();
+        if (avail == 0) {
+            conn->budget_wait = true;
+            budget_waiters_.push_back(conn);
+            return 0;
+        }
+        room = std::min(room, avail);
+    }
+
+    return room;
+}
+
+// Refresh EPOLLOUT if we have smthng to write, EPOLLIN unless side is paused
+void Proxy::refresh_interest(Connection* conn) {
+    if (options_.edge_triggered) return;  //  Interest set once at accept
+
+    update_backpressure(conn);
+
+    bool want_read_client = !conn->client_paused && !conn->budget_wait;
+    update_epoll_events(conn->client_fd, want_read_client, client_wants_write(conn));
+
+    bool want_read_server = !conn->server_paused && !conn->budget_wait;
+    update_epoll_events(conn->server_fd, want_read_server, !conn->server_out.empty());
+}
+
+void Proxy::resume_budget_waiters() {
+    if (!options_.budget || options_.budget->available() == 0) return;
+
+    std::vector<Connection*> waiters;
+    waiters.swap(budget_waiters_);
+    for (Connection* conn : waiters) {
+        conn->budget_wait = false;
+        if (conn->closed) continue;
+
+        //  Edge-triggered: no new edge will come for unread data, pump now
+        if (options_.edge_triggered) {
+            pump(conn);
+        } else {
+            refresh_interest(conn);
+        }
+    }
+}
+
+void Proxy::register_fd(int fd, Connection* conn, FdRole role) {
+    if (static_cast<std::size_t>(fd) >= fd_table_.size()) {
+        fd_table_.resize(std::max<std::size_t>(static_cast<std::size_t>(fd) + 1, fd_table_.size() * 2));
+    }
+
+    FdContext& ctx = fd_table_[fd];
+    ctx.conn = conn;
+    ctx.link = nullptr;
+    ctx.role = role;
+    ctx.gen++;
+    ctx.in_use = true;
+}
+
+void Proxy::unregister_fd(int fd) {
+    if (fd < 0 || static_cast<std::size_t>(fd) >= fd_table_.size()) return;
+
+    FdContext& ctx = fd_table_[fd];
+    ctx.conn = nullptr;
+    ctx.link = nullptr;
+    ctx.gen++;  //  Pending events for this fd turn stale
+    ctx.in_use = false;
+}
+
+//  Low 32 bits fd, high 32 bits generation
+uint64_t Proxy::event_data(int fd) const {
+    return (static_cast<uint64_t>(fd_table_[fd].gen) << 32) | static_cast<uint32_t>(fd);
+}
+
+//  nullptr for stale events: fd closed, or closed and reused in same batch
+FdContext* Proxy::context_for(uint64_t data) {
+    std::size_t fd = static_cast<uint32_t>(data);
+    uint32_t gen = static_cast<uint32_t>(data >> 32);
+
+    if (fd >= fd_table_.size()) return nullptr;
+    FdContext& ctx = fd_table_[fd];
+    if (!ctx.in_use || ctx.gen != gen) return nullptr;
+    return &ctx;
+}
+
+bool Proxy::add_fd_to_epoll(int fd, uint32_t events) {
     epoll_event ev{};
-    ev.data.ptr = context;
+    ev.data.u64 = event_data(fd);
     ev.events = events;
     if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &ev) == -1) return false;
+    fd_table_[fd].events = events;
     return true;
 }
 
-void Proxy::update_epoll_events(int fd, FdContext* context, bool want_read, bool want_write) {
+void Proxy::update_epoll_events(int fd, bool want_read, bool want_write) {
     if (fd == -1) return;
 
     uint32_t new_events = EPOLLRDHUP;
     if (want_read) new_events |= EPOLLIN;
     if (want_write) new_events |= EPOLLOUT;
 
+    //  Kernel already has this mask, save the syscall
+    if (fd_table_[fd].events == new_events) return;
+    fd_table_[fd].events = new_events;
+
     epoll_event ev{};
-    ev.data.ptr = context;
+    ev.data.u64 = event_data(fd);
     ev.events = new_events;
 
     if (epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, fd, &ev) == -1) {
         if (errno == ENOENT) {
-            add_fd_to_epoll(fd, context, ev.events);
+            add_fd_to_epoll(fd, ev.events);
         }
     }
 }
@@ -190,15 +572,24 @@ void Proxy::handle_listener_event(uint32_t events) {
             close(client_fd);
             continue;  //  try again
         }
-
-        int server_fd = connect_to_db();
-        if (server_fd == -1) {
-            close(client_fd);
-            continue;  //  try again
+        set_nodelay(client_fd);
+
+        //  Pooled client borrows a backend per transaction instead
+        int server_fd = -1;
+        if (options_.pool_size == 0) {
+            server_fd = warm_take();
+            if (server_fd == -1) {
+                server_fd = connect_to_db();
+                if (server_fd != -1 && options_.metrics) WorkerMetrics::add(options_.metrics->connects_cold);
+            }
+            if (server_fd == -1) {
+                close(client_fd);
+                continue;  //  try again
+            }
         }
 
-        auto conn = std::make_unique<Connection>();
-        conn->id = next_connection_id_++;
+        Connection* conn = acquire_connection();
+        conn->id = next_id();
 
         //  Add addr
         char addrbuf[64];
@@ -210,26 +601,41 @@ void Proxy::handle_listener_event(uint32_t events) {
         //  Add fd
         conn->client_fd = client_fd;
         conn->server_fd = server_fd;
-        Connection* conn_ptr = conn.get();
-        connections_.push_back(std::move(conn));
+        conn->client_out.setCapacity(options_.buffer_size);
+        conn->server_out.setCapacity(options_.buffer_size);
+
+        //  No pipe -> this link falls back to copying
+        if (splice_active_ && !open_splice_pipe(conn)) {
+            perror("pipe2");
+        }
 
         std::cout << "New link: client_fd=" << client_fd << " server_fd=" << server_fd << "\n";
+        if (options_.metrics) WorkerMetrics::add(options_.metrics->accepted);
 
         //  Add context
-        fd_context_map_[client_fd] = FdContext{ conn_ptr, FdRole::CLIENT };
-        fd_context_map_[server_fd] = FdContext{ conn_ptr, FdRole::SERVER };
+        register_fd(client_fd, conn, FdRole::CLIENT);
+        if (server_fd == -1) {
+            add_fd_to_epoll(client_fd, EPOLLIN | EPOLLRDHUP);
+            continue;
+        }
+        register_fd(server_fd, conn, FdRole::SERVER);
 
         //  Now we wait events on this link, 
         //  We don't need EPOLLOUT on client right now
-        add_fd_to_epoll(client_fd, &fd_context_map_[client_fd], EPOLLIN | EPOLLRDHUP);
-        add_fd_to_epoll(server_fd, &fd_context_map_[server_fd], EPOLLIN | EPOLLOUT | EPOLLRDHUP);
+        if (options_.edge_triggered) {
+            //  Armed once for everything, never modified
+            add_fd_to_epoll(client_fd, EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET);
+            add_fd_to_epoll(server_fd, EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET);
+        } else {
+            add_fd_to_epoll(client_fd, EPOLLIN | EPOLLRDHUP);
+            add_fd_to_epoll(server_fd, EPOLLIN | EPOLLOUT | EPOLLRDHUP);
+        }
     }
 }
 
-void Proxy::handle_socket_event(struct epoll_event& ev) {
+void Proxy::handle_socket_event(FdContext* context, struct epoll_event& ev) {
 
-    auto* context = static_cast<FdContext*>(ev.data.ptr);
-    if (!context || !context->conn) return;
+    if (!context->conn) return;
     Connection* conn = context->conn;
 
     bool is_client = (context->role == FdRole::CLIENT);
@@ -240,6 +646,11 @@ void Proxy::handle_socket_event(struct epoll_event& ev) {
         return;
     }
 
+    if (options_.pool_size > 0) {
+        pool_client_event(conn, ev.events);
+        return;
+    }
+
     //  Close event
     if (ev.events & (EPOLLHUP | EPOLLERR | EPOLLRDHUP)) {
         std::cerr << "Close fd=" << fd << " role=" << (is_client ? "client" : "server") << "\n";
@@ -247,91 +658,216 @@ void Proxy::handle_socket_event(struct epoll_event& ev) {
         return;
     }
 
+    if (options_.edge_triggered) {
+        //  Edges only say "something changed", remember it until EAGAIN
+        if (ev.events & EPOLLIN) {
+            (is_client ? conn->client_readable : conn->server_readable) = true;
+        }
+        if (ev.events & EPOLLOUT) {
+            (is_client ? conn->client_writable : conn->server_writable) = true;
+        }
+        pump(conn);
+        return;
+    }
+
     // Write to socket event
     if (ev.events & EPOLLOUT) {
-        std::string& out_buf = is_client ? conn->client_out : conn->server_out;
-        if (!out_buf.empty()) {
-            if (flush_buffer(fd, out_buf) == -1) {
-                close_connection(conn);
-                return;
-            }
-        }
+        if (write_side(conn, is_client) == -1) return;
     }
 
     // Read from socket event
     if (ev.events & EPOLLIN) {
-        char buf[8192];
-        ssize_t n = 0;
+        if (read_side(conn, is_client) == -1) return;
+    }
+
+    refresh_interest(conn);
+}
+
+//  Flush buffered bytes to this side's socket
+//  Returns bytes moved, -1 when link was closed
+ssize_t Proxy::write_side(Connection* conn, bool is_client) {
+    PROFILE_SCOPE(kSend);
+
+    //  Pass-through link: server -> client bytes go via pipe
+    if (is_client && conn->pipe_r != -1) {
+        ssize_t moved = splice_server_to_client(conn);
+        if (moved == -1) close_connection(conn);
+        return moved;
+    }
+
+    RingBuffer& out_buf = is_client ? conn->client_out : conn->server_out;
+    if (out_buf.empty()) return 0;
+
+    int fd = is_client ? conn->client_fd : conn->server_fd;
+    ssize_t sent = out_buf.writeTo(fd);
+    if (sent == -1) {
+        close_connection(conn);
+        return -1;
+    }
+
+    if (options_.budget) options_.budget->refund(static_cast<std::size_t>(sent));
+    if (!out_buf.empty()) {
+        (is_client ? conn->client_writable : conn->server_writable) = false;  //  Hit EAGAIN
+    }
+    return sent;
+}
 
-        while ((n = ::recv(fd, buf, sizeof(buf), 0)) > 0) {
+//  Read this side straight into peer's ring
+//  Stops at high mark or budget, EPOLLIN is dropped until peer drains
+//  Returns bytes moved, -1 when link was closed
+ssize_t Proxy::read_side(Connection* conn, bool is_client) {
+    if (!is_client && conn->pipe_r != -1) {
+        ssize_t moved = splice_server_to_client(conn);
+        if (moved == -1) close_connection(conn);
+        return moved;
+    }
+
+    int fd = is_client ? conn->client_fd : conn->server_fd;
+    RingBuffer& peer_buf = is_client ? conn->server_out : conn->client_out;
+
+    ssize_t total = 0;
+    ssize_t n = 1;  //  Not EOF until recv says so
+    iovec filled[2];
+    int nfilled = 0;
 
-            std::size_t sz = static_cast<std::size_t>(n);
+    while (true) {
+        std::size_t room = read_room(conn, is_client);
+        if (room == 0) break;
+
+        {
+            PROFILE_SCOPE(kRecv);
+            n = peer_buf.readFrom(fd, filled, nfilled, room);
+        }
+        if (n <= 0) break;
 
-            //  Interceptor GO 
-            if (interceptor_) {
+        total += n;
+        if (options_.budget) options_.budget->charge(static_cast<std::size_t>(n));
+
+        //  Interceptor GO
+        if (interceptor_) {
+            for (int i = 0; i < nfilled; i++) {
+                const char* data = static_cast<const char*>(filled[i].iov_base);
                 if (is_client) {
-                    interceptor_->onClientData(*conn, buf, sz);
+                    PROFILE_SCOPE(kInterceptClient);
+                    interceptor_->onClientData(*conn, data, filled[i].iov_len);
                 } else {
-                    interceptor_->onServerData(*conn, buf, sz);
-                } 
+                    PROFILE_SCOPE(kInterceptServer);
+                    interceptor_->onServerData(*conn, data, filled[i].iov_len);
+                }
             }
-
-            //  Routing
-            (is_client ? conn->server_out : conn->client_out).append(buf, sz);
         }
+    }
 
-        //  Connection closed
-        if (n == 0) {
-            std::cerr << "Received EOF on fd=" << fd << " role=" << (is_client ? "client" : "server") << "\n";
-            close_connection(conn);
-            return;
-        }
+    if (options_.metrics && total > 0) {
+        WorkerMetrics::add(is_client ? options_.metrics->bytes_c2s : options_.metrics->bytes_s2c,
+                           static_cast<std::uint64_t>(total));
+    }
 
-        //  Receive error
-        if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
-            perror("recv");
+    //  Connection closed
+    if (n == 0) {
+        std::cerr << "Received EOF on fd=" << fd << " role=" << (is_client ? "client" : "server") << "\n";
+        close_connection(conn);
+        return -1;
+    }
+
+    if (n < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            perror("recv");  //  Receive error
             close_connection(conn);
-            return;
+            return -1;
         }
+        (is_client ? conn->client_readable : conn->server_readable) = false;
     }
 
+    return total;
+}
 
-    // Refresh EPOLLOUT if we have smthng to write
-    auto it_client = fd_context_map_.find(conn->client_fd);
-    if (it_client != fd_context_map_.end()) {
-        bool want_write_client = !conn->client_out.empty();
-        update_epoll_events(conn->client_fd, &it_client->second, true, want_write_client);
-    }
+//  Edge-triggered driver: move bytes both ways until every ready
+//  side hit EAGAIN or backpressure, nothing else will wake us
+void Proxy::pump(Connection* conn) {
+    ssize_t moved = 1;
+    while (moved > 0 && !conn->closed) {
+        moved = 0;
+        for (bool is_client : { true, false }) {
+            bool writable = is_client ? conn->client_writable : conn->server_writable;
+            if (writable) {
+                ssize_t n = write_side(conn, is_client);
+                if (n == -1) return;
+                moved += n;
+            }
 
-    auto it_server = fd_context_map_.find(conn->server_fd);
-    if (it_server != fd_context_map_.end()) {
-        bool want_write_server = !conn->server_out.empty();
-        update_epoll_events(conn->server_fd, &it_server->second, true, want_write_server);
+            bool readable = is_client ? conn->client_readable : conn->server_readable;
+            if (readable) {
+                ssize_t n = read_side(conn, is_client);
+                if (n == -1) return;
+                moved += n;
+            }
+        }
     }
 }
 
 void Proxy::run() {
+    if (options_.io_uring) {
+        if (run_uring()) return;
+        std::cerr << "io_uring unavailable, worker=" << options_.worker_id << " falls back to epoll\n";
+    }
+
     const int MAX_EVENTS = 64;
     epoll_event events[MAX_EVENTS];
 
-    while (true) {
-        int n = epoll_wait(epoll_fd_, events, MAX_EVENTS, -1);
+    //  Pre-warmed backend sockets, io_uring connects its own way
+    warm_refill_ms_ = now_ms();
+    warm_tokens_ = std::min(options_.prewarm_rate, static_cast<double>(options_.prewarm));
+    warm_fill();
+
+    bool running = true;
+    while (running) {
+        //  Parked links need a poll for budget freed by other workers
+        int timeout = budget_waiters_.empty() ? -1 : 10;
+        if (options_.pool_size > 0) timeout = pool_timeout(timeout);
+        if (options_.prewarm > 0) timeout = warm_timeout(timeout);
+        int n = epoll_wait(epoll_fd_, events, MAX_EVENTS, timeout);
         if (n == -1) {
             if (errno == EINTR) continue;  //  Interrupted by signal, just continue
             perror("epoll_wait");
             break;
         }
+        std::uint64_t busy_start = options_.metrics ? WorkerMetrics::now() : 0;
 
         for (int i = 0; i < n; i++) {
-            auto* context = static_cast<FdContext*>(events[i].data.ptr);
-            if (!context) continue;
+            FdContext* context = context_for(events[i].data.u64);
+            if (!context) continue;  //  Stale, fd was closed earlier in this batch
 
             if (context->role == FdRole::LISTENER) {
                 handle_listener_event(events[i].events);
+            } else if (context->role == FdRole::WAKEUP) {
+                running = false;
+            } else if (context->role == FdRole::POOL_SERVER) {
+                pool_link_event(context->link, events[i].events);
+            } else if (context->role == FdRole::WARM) {
+                handle_warm_event(static_cast<int>(static_cast<uint32_t>(events[i].data.u64)), events[i].events);
             } else {
-                handle_socket_event(events[i]);
+                handle_socket_event(context, events[i]);
             }
         }
+
+        resume_budget_waiters();
+        if (options_.pool_size > 0) pool_retry();
+        if (options_.prewarm > 0) {
+            warm_expire();
+            warm_fill();
+        }
+        reclaim_closed_connections();
+
+        if (options_.metrics) options_.metrics->loop_ns.record(WorkerMetrics::now() - busy_start);
+    }
+}
+
+void Proxy::stop() {
+    if (wakeup_fd_ != -1) {
+        uint64_t one = 1;
+        ssize_t n = ::write(wakeup_fd_, &one, sizeof(one));
+        (void)n;
     }
 }
 
@@ -2,56 +2,232 @@
 
 #include <iostream>
 #include <cstdint>
+#include <deque>
 #include <string>
 #include <vector>
-#include <map>
 #include <memory>
 #include <unistd.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <sys/socket.h>
 #include <arpa/inet.h>
 
+#include "BufferBudget.h"
 #include "Connection.h"
+#include "IoUring.h"
+#include "Metrics.h"
 #include "ProtocolInterceptor.h"
 
+//  Per-reactor settings, every worker thread owns one Proxy
+struct ProxyOptions {
+    int  worker_id  = 0;
+    bool reuse_port = false;  //  SO_REUSEPORT, kernel balances accepts between workers
+    static constexpr std::size_t kMinBufferSize = 4096;
+    std::size_t buffer_size = 64 * 1024;  //  Ring capacity per direction of a link
+    bool splice = false;                  //  server -> client via splice(), if interceptor allows
+    std::size_t pipe_size = 0;            //  F_SETPIPE_SZ for splice pipes, 0 = kernel default
+
+    //  Water marks per direction: stop reading a side when its peer holds
+    //  >= high bytes, resume at <= low. 0 = high is buffer capacity, low is high / 2
+    std::size_t c2s_high = 0;
+    std::size_t c2s_low  = 0;
+    std::size_t s2c_high = 0;
+    std::size_t s2c_low  = 0;
+
+    BufferBudget* budget = nullptr;       //  Shared by workers, nullptr = unlimited
+
+    //  EPOLLET: interest armed once per fd, never EPOLL_CTL_MOD
+    bool edge_triggered = false;
+
+    //  io_uring reactor instead of epoll, epoll stays as fallback
+    bool io_uring = false;
+    unsigned uring_entries = 4096;        //  SQ size
+    unsigned uring_buffers = 4096;        //  Provided recv buffers per worker, 16-bit ids
+    std::size_t uring_buffer_size = 16 * 1024;
+
+    //  Ring storage kept warm by idle pooled connections, released beyond it
+    std::size_t pool_keep_bytes = 8 * 1024 * 1024;
+
+    //  This reactor's own counters slot, nullptr = not collected
+    WorkerMetrics* metrics = nullptr;
+
+    //  Connected, pre-startup backend sockets kept ready for accepts,
+    //  started at most prewarm_rate per second. Epoll reactor, 0 = off
+    std::size_t prewarm = 0;
+    double prewarm_rate = 100;
+
+    //  Transaction pooling: clients share pool_size backends of this worker,
+    //  0 = every client gets its own backend. Level-triggered epoll only
+    std::size_t pool_size = 0;
+    std::string pool_user;
+    std::string pool_database;
+    std::string pool_password;  //  Answers cleartext password auth, nothing else
+};
+
 class Proxy {
 
 public:
-    Proxy(std::string& lst_host, uint16_t listen_port, std::string& db_host, uint16_t dbs_port);
+    Proxy(std::string& lst_host, uint16_t listen_port, std::string& db_host, uint16_t dbs_port,
+          const ProxyOptions& options = ProxyOptions());
 
     void setInterceptor(std::unique_ptr<IProtocolInterceptor> interceptor);
     bool init();
     void run();
 
+    //  Thread-safe, run() returns after current batch
+    void stop();
+
 private:
     std::unique_ptr<IProtocolInterceptor> interceptor_;
     std::string lst_host_;
     uint16_t lst_port_;
     std::string dbs_host_;
     uint16_t dbs_port_;
+    ProxyOptions options_;
 
-
-
-    int next_connection_id_ = 1;
     int epoll_fd_   = -1;
     int listener_fd_ = -1;
+    int wakeup_fd_   = -1;  //  eventfd, poked by stop()
+    bool splice_active_ = false;
+
+    //  Normalised water marks
+    std::size_t c2s_high_ = 0;
+    std::size_t c2s_low_  = 0;
+    std::size_t s2c_high_ = 0;
+    std::size_t s2c_low_  = 0;
 
-    //  All connections lives here
+    //  Links parked by global budget, re-armed when it frees
+    std::vector<Connection*> budget_waiters_;
+
+    //  All connections lives here, slab only grows to peak concurrency
     std::vector<std::unique_ptr<Connection>> connections_;
+    std::vector<Connection*> free_connections_;    //  Ready for accept
+    std::vector<Connection*> closed_connections_;  //  Reclaimed after epoll batch
+    std::size_t pooled_buffer_bytes_ = 0;          //  Ring storage held by free_connections_
+
+    //  FdContext for every fd, indexed by fd, fds are small and dense
+    std::vector<FdContext> fd_table_;
 
-    //  FdContext for every Fd by key 
-    std::map<int, FdContext> fd_context_map_;
+    //  Backend address, parsed once in init()
+    sockaddr_in db_addr_{};
+
+    //  Pre-warmed backend sockets, oldest first
+    //  Replaced well before PostgreSQL's authentication_timeout (60 s default)
+    static constexpr std::int64_t kWarmMaxAgeMs = 30000;
+    struct WarmSocket {
+        int fd;
+        std::int64_t since_ms;
+    };
+    std::deque<WarmSocket> warm_ready_;
+    std::size_t warm_connecting_ = 0;
+    double warm_tokens_ = 0;
+    std::int64_t warm_refill_ms_ = 0;
+
+    //  io_uring reactor state, created on the worker thread (SINGLE_ISSUER)
+    std::unique_ptr<IoUring> uring_;
+    bool uring_running_ = false;
+    bool uring_multishot_accept_ = true;
+    bool uring_multishot_recv_ = true;
+    bool uring_timeout_armed_ = false;
+    bool uring_buffers_recycled_ = false;
+    std::vector<Connection*> uring_starved_;  //  Recv ended on ENOBUFS
+    std::vector<Connection*> uring_unsent_;   //  Sends that got no sqe
+    std::vector<Connection*> uring_uncancelled_;  //  Closed links whose cancels got no sqe
+
+    //  Transaction pooling state
+    std::vector<std::unique_ptr<ServerLink>> pool_links_;
+    std::vector<ServerLink*> pool_idle_;       //  Most recently returned last
+    std::deque<Connection*> pool_waiters_;     //  Need a backend, served FIFO
+    std::vector<Connection*> pool_greeters_;   //  Startup done before any backend was up
+    std::string pool_params_;                  //  ParameterStatus replayed to every client
+    bool pool_ready_ = false;
+    std::int64_t pool_retry_at_ = 0;           //  Reconnect of down backends, ms, 0 = none
 
     bool setup_listener();
     bool setup_epoll();
 
     void handle_listener_event(uint32_t events);
-    void handle_socket_event(struct epoll_event& ev);
+    void handle_socket_event(FdContext* context, struct epoll_event& ev);
 
     int  connect_to_db();
+    static std::int64_t now_ms();
+    void warm_fill();
+    void handle_warm_event(int fd, uint32_t events);
+    int  warm_take();
+    void warm_expire();
+    int  warm_timeout(int timeout) const;
+    bool open_splice_pipe(Connection* conn);
+    ssize_t splice_server_to_client(Connection* conn);
+    ssize_t write_side(Connection* conn, bool is_client);
+    ssize_t read_side(Connection* conn, bool is_client);
+    void pump(Connection* conn);
+    bool client_wants_write(const Connection* conn) const;
+    std::size_t s2c_buffered(const Connection* conn) const;
+    std::size_t s2c_high(const Connection* conn) const;
+    void update_backpressure(Connection* conn);
+    std::size_t read_room(Connection* conn, bool from_client);
+    void refresh_interest(Connection* conn);
+    void resume_budget_waiters();
+    static int next_id();
+    Connection* acquire_connection();
     void close_connection(Connection* conn);
-    void update_epoll_events(int fd, FdContext* context, bool want_read, bool want_write);
-    bool add_fd_to_epoll(int fd, FdContext* context, uint32_t events);
+    void reclaim_closed_connections();
+    void register_fd(int fd, Connection* conn, FdRole role);
+    void unregister_fd(int fd);
+    FdContext* context_for(uint64_t data);
+    uint64_t event_data(int fd) const;
+    void update_epoll_events(int fd, bool want_read, bool want_write);
+    bool add_fd_to_epoll(int fd, uint32_t events);
+
+    //  io_uring reactor, ProxyUring.cpp
+    bool run_uring();
+    void uring_handle(io_uring_cqe* cqe);
+    void uring_arm_accept();
+    void uring_arm_wakeup();
+    void uring_arm_timeout();
+    void uring_arm_recv(Connection* conn, bool is_client);
+    void uring_cancel(Connection* conn);
+    void uring_on_accept(int res, uint32_t flags);
+    void uring_on_connect(Connection* conn, int res);
+    void uring_on_recv(Connection* conn, bool is_client, int res, uint32_t flags);
+    void uring_on_send(Connection* conn, bool to_client, int res);
+    void uring_submit_sends(Connection* conn, bool to_client);
+    void uring_pause_check(Connection* conn, bool is_client);
+    void uring_resume_check(Connection* conn, bool is_client);
+    void uring_resume_waiters();
+    void uring_close(Connection* conn);
+    void uring_finalize(Connection* conn);
+
+    //  Transaction pooling, ProxyPool.cpp
+    bool pool_init();
+    int  pool_timeout(int timeout) const;
+    void pool_retry();
+    void pool_connect(ServerLink* link);
+    void pool_link_down(ServerLink* link);
+    void pool_link_event(ServerLink* link, uint32_t events);
+    bool pool_startup_read(ServerLink* link);
+    bool pool_server_read(ServerLink* link);
+    bool pool_server_process(ServerLink* link);
+    bool pool_server_write(ServerLink* link);
+    void pool_sync_done(ServerLink* link);
+    void pool_client_event(Connection* conn, uint32_t events);
+    bool pool_client_read(Connection* conn);
+    bool pool_client_frame(Connection* conn);
+    bool pool_client_startup(Connection* conn, const char* packet, std::size_t len);
+    bool pool_client_wants_read(const Connection* conn) const;
+    void pool_client_closed(Connection* conn);
+    bool pool_greet(Connection* conn);
+    bool pool_reject(Connection* conn, const char* sqlstate, const std::string& text);
+    bool pool_attach(Connection* conn);
+    void pool_release(ServerLink* link);
+    void pool_lend(ServerLink* link);
+    void pool_forward(Connection* conn, ServerLink* link, const char* msg, std::size_t len);
+    void pool_ensure_statement(Connection* conn, ServerLink* link, const std::string& name);
+    void pool_close_statement(ServerLink* link, const std::string& name);
+    void pool_to_client(Connection* conn, const char* data, std::size_t len);
+    std::size_t pool_link_room(const ServerLink* link) const;
+    void pool_refresh(Connection* conn);
+    void pool_refresh_link(ServerLink* link);
 };
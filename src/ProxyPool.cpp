@@ -0,0 +1,835 @@
+#include "Proxy.h"
+
+#include <algorithm>
+#include <cstring>
+#include <string_view>
+
+#include "Profile.h"
+
+//  Transaction pooling: options_.pool_size backends per worker, logged in
+//  once as pool_user, lent to clients one transaction at a time:
+//    startup  - the proxy answers the client's StartupMessage itself,
+//               replaying ParameterStatus of the first backend that came up
+//    lend     - first message of a transaction takes an idle backend,
+//               clients queue FIFO while all of them are busy
+//    return   - ReadyForQuery 'I' with every Sync answered and no extended
+//               batch open gives the backend back
+//    re-Parse - named Parse messages are kept per client and sent again
+//               before a Bind/Describe on a backend that lacks them,
+//               their ParseComplete/CloseComplete never reach the client
+//  Interceptor sees the client stream and what the client receives,
+//  same as on a direct link. A client that leaves mid-transaction takes
+//  its backend with it, the slot reconnects
+
+namespace {
+
+constexpr std::uint32_t kProtocol3 = 196608;
+constexpr std::uint32_t kSslRequestCode = 80877103;
+constexpr std::uint32_t kGssEncRequestCode = 80877104;
+constexpr std::uint32_t kMaxStartup = 10000;
+constexpr std::uint32_t kMaxMessage = 1u << 30;
+constexpr std::size_t kReadChunk = 16 * 1024;
+constexpr std::int64_t kRetryMs = 1000;  //  Down backend reconnect delay
+
+std::uint32_t be32(const char* p) {
+    return (static_cast<std::uint32_t>(static_cast<unsigned char>(p[0])) << 24)
+         | (static_cast<std::uint32_t>(static_cast<unsigned char>(p[1])) << 16)
+         | (static_cast<std::uint32_t>(static_cast<unsigned char>(p[2])) << 8)
+         |  static_cast<std::uint32_t>(static_cast<unsigned char>(p[3]));
+}
+
+void put32(std::string& out, std::uint32_t v) {
+    out += static_cast<char>(v >> 24);
+    out += static_cast<char>(v >> 16);
+    out += static_cast<char>(v >> 8);
+    out += static_cast<char>(v);
+}
+
+void message(std::string& out, char type, std::string_view body) {
+    out += type;
+    put32(out, static_cast<std::uint32_t>(body.size() + 4));
+    out += body;
+}
+
+//  NUL-terminated string at pos, pos moves past it, empty if unterminated
+std::string_view cstring(const char* data, std::size_t len, std::size_t& pos) {
+    const void* end = pos < len ? std::memchr(data + pos, '\0', len - pos) : nullptr;
+    if (!end) {
+        pos = len;
+        return {};
+    }
+    std::string_view s(data + pos, static_cast<const char*>(end) - (data + pos));
+    pos += s.size() + 1;
+    return s;
+}
+
+//  FNV-1a 64 over the whole message, 0 is kept for "text unknown"
+std::uint64_t parse_hash(const char* data, std::size_t len) {
+    std::uint64_t h = 14695981039346656037ull;
+    for (std::size_t i = 0; i < len; i++) {
+        h ^= static_cast<unsigned char>(data[i]);
+        h *= 1099511628211ull;
+    }
+    return h ? h : 1;
+}
+
+}  // namespace
+
+bool Proxy::pool_init() {
+    for (std::size_t i = 0; i < options_.pool_size; i++) {
+        pool_links_.push_back(std::make_unique<ServerLink>());
+        pool_connect(pool_links_.back().get());
+    }
+
+    std::cout << "POOL: " << options_.pool_size << " backends as " << options_.pool_user
+              << "@" << options_.pool_database << " worker=" << options_.worker_id << "\n";
+    return true;
+}
+
+//  epoll_wait timeout, shortened while a reconnect is due
+int Proxy::pool_timeout(int timeout) const {
+    if (pool_retry_at_ == 0) return timeout;
+    std::int64_t wait = std::max<std::int64_t>(pool_retry_at_ - now_ms(), 0);
+    return timeout == -1 ? static_cast<int>(wait) : std::min(timeout, static_cast<int>(wait));
+}
+
+void Proxy::pool_retry() {
+    if (pool_retry_at_ == 0 || now_ms() < pool_retry_at_) return;
+
+    pool_retry_at_ = 0;
+    for (auto& link : pool_links_) {
+        if (link->state == ServerLink::State::Down) pool_connect(link.get());
+    }
+}
+
+void Proxy::pool_connect(ServerLink* link) {
+    int fd = connect_to_db();
+    if (fd == -1) {
+        perror("pool connect");
+        pool_link_down(link);
+        return;
+    }
+
+    link->fd = fd;
+    link->state = ServerLink::State::Connecting;
+    register_fd(fd, nullptr, FdRole::POOL_SERVER);
+    fd_table_[fd].link = link;
+    add_fd_to_epoll(fd, EPOLLOUT | EPOLLRDHUP);
+}
+
+//  Backend is gone or can not be trusted anymore: close it, drop the client
+//  that had it, reconnect the slot later
+void Proxy::pool_link_down(ServerLink* link) {
+    if (link->fd != -1) {
+        epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, link->fd, nullptr);
+        close(link->fd);
+        unregister_fd(link->fd);
+        link->fd = -1;
+    }
+
+    auto idle = std::find(pool_idle_.begin(), pool_idle_.end(), link);
+    if (idle != pool_idle_.end()) pool_idle_.erase(idle);
+
+    link->state = ServerLink::State::Down;
+    link->in.clear();
+    link->pass = 0;
+    link->out.clear();
+    link->out_off = 0;
+    link->params.clear();
+    link->prepared.clear();
+    link->expect.clear();
+    link->syncs_sent = link->syncs_done = 0;
+    link->batch_open = false;
+
+    if (pool_retry_at_ == 0) pool_retry_at_ = now_ms() + kRetryMs;
+
+    Connection* conn = link->client;
+    link->client = nullptr;
+    if (conn) {
+        conn->link = nullptr;
+        close_connection(conn);
+    }
+}
+
+void Proxy::pool_link_event(ServerLink* link, uint32_t events) {
+    if (events & (EPOLLHUP | EPOLLERR | EPOLLRDHUP)) {
+        std::cerr << "Close fd=" << link->fd << " role=pool\n";
+        pool_link_down(link);
+        return;
+    }
+
+    if (link->state == ServerLink::State::Connecting) {
+        if (!(events & EPOLLOUT)) return;
+
+        int err = 0;
+        socklen_t err_len = sizeof(err);
+        if (getsockopt(link->fd, SOL_SOCKET, SO_ERROR, &err, &err_len) == -1 || err != 0) {
+            std::cerr << "Pool: connect failed, " << std::strerror(err ? err : errno) << "\n";
+            pool_link_down(link);
+            return;
+        }
+
+        std::string body;
+        put32(body, kProtocol3);
+        body.append("user").append(1, '\0').append(options_.pool_user).append(1, '\0');
+        body.append("database").append(1, '\0').append(options_.pool_database).append(1, '\0');
+        body += '\0';
+        put32(link->out, static_cast<std::uint32_t>(body.size() + 4));
+        link->out += body;
+        link->state = ServerLink::State::Startup;
+    }
+
+    if (events & EPOLLOUT) {
+        if (!pool_server_write(link)) return;
+
+        //  Client messages held back by a full link may go now
+        Connection* conn = link->client;
+        if (conn && !conn->pool_in.empty() && !pool_client_frame(conn)) return;
+    }
+
+    if (events & EPOLLIN) {
+        bool up = link->state == ServerLink::State::Startup ? pool_startup_read(link) : pool_server_read(link);
+        if (!up) return;
+    }
+
+    if (link->client) {
+        pool_refresh(link->client);
+    } else {
+        pool_refresh_link(link);
+    }
+}
+
+//  Login of a pool backend: trust or cleartext password, up to its first Z
+//  Returns false when the link went down
+bool Proxy::pool_startup_read(ServerLink* link) {
+    char chunk[kReadChunk];
+    ssize_t n;
+    while ((n = ::recv(link->fd, chunk, sizeof(chunk), 0)) > 0) {
+        link->in.append(chunk, static_cast<std::size_t>(n));
+    }
+    if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+        std::cerr << "Pool: backend closed during startup\n";
+        pool_link_down(link);
+        return false;
+    }
+
+    std::size_t pos = 0;
+    while (link->in.size() - pos >= 5) {
+        const char* msg = link->in.data() + pos;
+        std::uint32_t len = be32(msg + 1);
+        if (len < 4 || len > kMaxStartup) {
+            pool_link_down(link);
+            return false;
+        }
+        if (link->in.size() - pos < 1 + len) break;
+        pos += 1 + len;
+
+        const char* body = msg + 5;
+        std::size_t body_len = len - 4;
+        switch (msg[0]) {
+            case 'R': {
+                std::uint32_t method = body_len >= 4 ? be32(body) : ~0u;
+                if (method == 0) break;  //  AuthenticationOk
+                if (method == 3 && !options_.pool_password.empty()) {
+                    std::string password = options_.pool_password;
+                    password += '\0';
+                    message(link->out, 'p', password);
+                    break;
+                }
+                std::cerr << "Pool: backend asks for auth method " << method
+                          << ", only trust and password (PGPASSWORD) are supported\n";
+                pool_link_down(link);
+                return false;
+            }
+            case 'S':
+                link->params.append(msg, 1 + len);
+                break;
+            case 'E': {
+                //  Fields are code byte + cstring, M is the human message
+                std::size_t at = 0;
+                std::string_view text;
+                while (at < body_len && body[at] != '\0') {
+                    char code = body[at++];
+                    std::string_view value = cstring(body, body_len, at);
+                    if (code == 'M') text = value;
+                }
+                std::cerr << "Pool: backend login failed, " << text << "\n";
+                pool_link_down(link);
+                return false;
+            }
+            case 'Z':
+                if (!pool_ready_) {
+                    pool_ready_ = true;
+                    pool_params_ = link->params;
+                    std::vector<Connection*> greeters;
+                    greeters.swap(pool_greeters_);
+                    for (Connection* conn : greeters) {
+                        if (pool_greet(conn) && pool_client_frame(conn)) pool_refresh(conn);
+                    }
+                }
+                link->params.clear();
+                link->in.erase(0, pos);
+                link->state = ServerLink::State::Idle;
+                pool_lend(link);
+                return link->fd != -1;
+            default:
+                break;  //  BackendKeyData, notices
+        }
+    }
+
+    link->in.erase(0, pos);
+    return pool_server_write(link);
+}
+
+//  Forwarded bytes are bounded by the client ring, the rest waits in the socket
+std::size_t Proxy::pool_link_room(const ServerLink* link) const {
+    if (!link->client) return kReadChunk;  //  Idle, read only to discard
+    std::size_t space = link->client->client_out.space();
+    return space > link->in.size() ? space - link->in.size() : 0;
+}
+
+bool Proxy::pool_server_read(ServerLink* link) {
+    ssize_t n = 1;
+    std::size_t total = 0;
+    while (true) {
+        //  Leftover of an earlier read first, it may belong to the next client
+        if (!pool_server_process(link)) return false;
+
+        std::size_t room = std::min(pool_link_room(link), kReadChunk);
+        if (room == 0) break;
+
+        char chunk[kReadChunk];
+        {
+            PROFILE_SCOPE(kRecv);
+            n = ::recv(link->fd, chunk, room, 0);
+        }
+        if (n <= 0) break;
+
+        total += static_cast<std::size_t>(n);
+        link->in.append(chunk, static_cast<std::size_t>(n));
+    }
+
+    if (options_.metrics && total > 0) WorkerMetrics::add(options_.metrics->bytes_s2c, total);
+
+    if (n == 0) {
+        std::cerr << "Received EOF on fd=" << link->fd << " role=pool\n";
+        pool_link_down(link);
+        return false;
+    }
+    if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+        perror("recv");
+        pool_link_down(link);
+        return false;
+    }
+    return true;
+}
+
+/**
+Server stream of a lent backend, same framing the parser uses:
+only headers are looked at, bodies stream through in whatever pieces fit
+the client ring. Three replies are special:
+  '1' ParseComplete, '3' CloseComplete  - matched to link->expect, injected ones dropped
+  'Z' ReadyForQuery                     - ends a Sync batch, may return the backend
+Without a client (idle backend) everything is read and dropped
+**/
+
+bool Proxy::pool_server_process(ServerLink* link) {
+    std::size_t pos = 0;
+    while (pos < link->in.size()) {
+        const char* data = link->in.data() + pos;
+        std::size_t avail = link->in.size() - pos;
+        Connection* conn = link->client;
+        std::size_t space = conn ? conn->client_out.space() : SIZE_MAX;
+
+        if (link->pass > 0) {
+            std::size_t n = std::min({ link->pass, avail, space });
+            if (n == 0) break;
+            if (conn) pool_to_client(conn, data, n);
+            link->pass -= n;
+            pos += n;
+            continue;
+        }
+
+        if (avail < 5) break;
+        char type = data[0];
+        std::uint32_t len = be32(data + 1);
+        if (len < 4 || len > kMaxMessage) {
+            pool_link_down(link);
+            return false;
+        }
+
+        if (type == 'Z') {
+            if (avail < 1 + len || space < 1 + len) break;
+            char status = len > 4 ? data[5] : 'I';
+            if (conn) pool_to_client(conn, data, 1 + len);
+            pos += 1 + len;
+
+            pool_sync_done(link);
+            if (conn && status == 'I' && link->syncs_done == link->syncs_sent && !link->batch_open) {
+                link->in.erase(0, pos);
+                pos = 0;
+                pool_release(link);
+                if (link->fd == -1) return false;
+            }
+            continue;
+        }
+
+        if ((type == '1' || type == '3') && !link->expect.empty() && link->expect.front().reply == type) {
+            if (avail < 1 + len) break;
+            bool swallow = link->expect.front().swallow;
+            if (!swallow && space < 1 + len) break;
+            link->expect.pop_front();
+            if (!swallow && conn) pool_to_client(conn, data, 1 + len);
+            pos += 1 + len;
+            continue;
+        }
+
+        if (space < 5) break;
+        if (conn) pool_to_client(conn, data, 5);
+        link->pass = len - 4;
+        pos += 5;
+    }
+
+    link->in.erase(0, pos);
+    return true;
+}
+
+//  One Z: whatever of its batch did not answer was skipped after an error
+void Proxy::pool_sync_done(ServerLink* link) {
+    if (link->syncs_done < link->syncs_sent) link->syncs_done++;
+
+    while (!link->expect.empty() && link->expect.front().sync < link->syncs_done) {
+        const ServerLink::Expect& skipped = link->expect.front();
+        if (skipped.reply == '1') {
+            auto it = link->prepared.find(skipped.name);
+            if (it != link->prepared.end() && it->second == skipped.hash) link->prepared.erase(it);
+        } else if (!skipped.name.empty()) {
+            link->prepared[skipped.name] = 0;  //  Close did not run, statement may still be there
+        }
+        link->expect.pop_front();
+    }
+}
+
+bool Proxy::pool_server_write(ServerLink* link) {
+    PROFILE_SCOPE(kSend);
+
+    while (link->out_off < link->out.size()) {
+        ssize_t n = ::send(link->fd, link->out.data() + link->out_off, link->out.size() - link->out_off, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            perror("send");
+            pool_link_down(link);
+            return false;
+        }
+        link->out_off += static_cast<std::size_t>(n);
+    }
+
+    if (link->out_off == link->out.size()) {
+        link->out.clear();
+        link->out_off = 0;
+    }
+    return true;
+}
+
+void Proxy::pool_client_event(Connection* conn, uint32_t events) {
+    if (events & (EPOLLHUP | EPOLLERR | EPOLLRDHUP)) {
+        std::cerr << "Close fd=" << conn->client_fd << " role=client\n";
+        close_connection(conn);
+        return;
+    }
+
+    if (events & EPOLLOUT) {
+        if (write_side(conn, true) == -1) return;
+        if (conn->pool_phase == Connection::PoolPhase::Closing && conn->client_out.empty()) {
+            close_connection(conn);
+            return;
+        }
+
+        //  Ring has room again, server bytes parked in the link may move
+        ServerLink* link = conn->link;
+        if (link && !link->in.empty() && !pool_server_read(link)) return;
+        if (conn->closed) return;
+    }
+
+    if (events & EPOLLIN) {
+        if (!pool_client_read(conn)) return;
+    }
+
+    pool_refresh(conn);
+}
+
+bool Proxy::pool_client_wants_read(const Connection* conn) const {
+    using Phase = Connection::PoolPhase;
+    if (conn->pool_phase == Phase::Greeting || conn->pool_phase == Phase::Closing) return false;
+    if (conn->pool_phase == Phase::Startup) return true;
+    if (conn->pool_waiting) return false;
+
+    const ServerLink* link = conn->link;
+    if (link && link->out.size() - link->out_off >= c2s_high_) return false;
+    if (conn->pool_in.size() < c2s_high_) return true;
+
+    //  A message bigger than the mark has to come in whole anyway
+    return conn->pool_in.size() < 5 || conn->pool_in.size() < 1 + std::size_t(be32(conn->pool_in.data() + 1));
+}
+
+bool Proxy::pool_client_read(Connection* conn) {
+    ssize_t n = 1;
+    std::size_t total = 0;
+    while (pool_client_wants_read(conn)) {
+        char chunk[kReadChunk];
+        {
+            PROFILE_SCOPE(kRecv);
+            n = ::recv(conn->client_fd, chunk, sizeof(chunk), 0);
+        }
+        if (n <= 0) break;
+
+        total += static_cast<std::size_t>(n);
+        if (interceptor_) {
+            PROFILE_SCOPE(kInterceptClient);
+            interceptor_->onClientData(*conn, chunk, static_cast<std::size_t>(n));
+        }
+        conn->pool_in.append(chunk, static_cast<std::size_t>(n));
+        if (!pool_client_frame(conn)) return false;
+    }
+
+    if (options_.metrics && total > 0) WorkerMetrics::add(options_.metrics->bytes_c2s, total);
+
+    if (n == 0) {
+        std::cerr << "Received EOF on fd=" << conn->client_fd << " role=client\n";
+        close_connection(conn);
+        return false;
+    }
+    if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+        perror("recv");
+        close_connection(conn);
+        return false;
+    }
+    return true;
+}
+
+//  Whole client messages out of pool_in, into the lent backend
+//  Returns false when the client was closed
+bool Proxy::pool_client_frame(Connection* conn) {
+    using Phase = Connection::PoolPhase;
+
+    std::size_t pos = 0;
+    bool open = true;
+    while (open) {
+        const char* data = conn->pool_in.data() + pos;
+        std::size_t avail = conn->pool_in.size() - pos;
+
+        if (conn->pool_phase == Phase::Startup) {
+            if (avail < 8) break;
+            std::uint32_t len = be32(data);
+            if (len < 8 || len > kMaxStartup) {
+                close_connection(conn);
+                return false;
+            }
+            if (avail < len) break;
+            pos += len;
+            open = pool_client_startup(conn, data, len);
+            continue;
+        }
+        if (conn->pool_phase != Phase::Ready) break;
+
+        if (avail < 5) break;
+        char type = data[0];
+        std::uint32_t len = be32(data + 1);
+        if (len < 4 || len > kMaxMessage) {
+            close_connection(conn);
+            return false;
+        }
+        if (avail < 1 + len) break;
+
+        //  Terminate is ours, the backend stays
+        if (type == 'X') {
+            close_connection(conn);
+            return false;
+        }
+
+        if (!conn->link && !pool_attach(conn)) break;
+        ServerLink* link = conn->link;
+        if (link->out.size() - link->out_off >= c2s_high_) break;
+
+        pool_forward(conn, link, data, 1 + len);
+        pos += 1 + len;
+    }
+
+    if (!open) return false;
+    conn->pool_in.erase(0, pos);
+
+    //  Link down closes its client too
+    if (conn->link && !pool_server_write(conn->link)) return false;
+    return true;
+}
+
+//  SSLRequest is refused, StartupMessage is answered by the proxy
+//  Returns false when the client was closed
+bool Proxy::pool_client_startup(Connection* conn, const char* packet, std::size_t len) {
+    std::uint32_t code = be32(packet + 4);
+    if (code == kSslRequestCode || code == kGssEncRequestCode) {
+        if (conn->client_out.full()) {
+            close_connection(conn);
+            return false;
+        }
+        pool_to_client(conn, "N", 1);
+        return true;
+    }
+    if (code != kProtocol3) {
+        //  CancelRequest included, backends are shared, pids mean nothing
+        return pool_reject(conn, "08P01", "pooled proxy accepts protocol 3.0 startup only");
+    }
+
+    std::string_view user;
+    std::string_view database;
+    std::size_t pos = 8;
+    while (pos < len && packet[pos] != '\0') {
+        std::string_view key = cstring(packet, len, pos);
+        std::string_view value = cstring(packet, len, pos);
+        if (key == "user") user = value;
+        if (key == "database") database = value;
+    }
+    if (database.empty()) database = user;
+
+    if (user != options_.pool_user || database != options_.pool_database) {
+        return pool_reject(conn, "28000", "pooled proxy serves user \"" + options_.pool_user
+                                          + "\" database \"" + options_.pool_database + "\" only");
+    }
+
+    conn->pool_phase = Connection::PoolPhase::Greeting;
+    if (pool_ready_) return pool_greet(conn);
+    pool_greeters_.push_back(conn);
+    return true;
+}
+
+//  What a backend says after login, ParameterStatus from the first one
+//  Returns false when the client was closed
+bool Proxy::pool_greet(Connection* conn) {
+    std::string out;
+    message(out, 'R', std::string_view("\0\0\0\0", 4));
+    out += pool_params_;
+
+    //  Cancel is not supported, the key only has to look right
+    std::string key;
+    put32(key, static_cast<std::uint32_t>(conn->id));
+    put32(key, 0);
+    message(out, 'K', key);
+    message(out, 'Z', "I");
+
+    //  A cut greeting would break the client's stream, better no link at all
+    if (out.size() > conn->client_out.space()) {
+        std::cerr << "Pool: greeting of " << out.size() << " bytes does not fit --buffer-size, closing client_fd="
+                  << conn->client_fd << "\n";
+        close_connection(conn);
+        return false;
+    }
+
+    pool_to_client(conn, out.data(), out.size());
+    conn->pool_phase = Connection::PoolPhase::Ready;
+    return true;
+}
+
+//  FATAL ErrorResponse, the client is closed once it is sent
+bool Proxy::pool_reject(Connection* conn, const char* sqlstate, const std::string& text) {
+    std::string body;
+    body.append("SFATAL").append(1, '\0');
+    body.append("VFATAL").append(1, '\0');
+    body.append("C").append(sqlstate).append(1, '\0');
+    body.append("M").append(text).append(1, '\0');
+    body += '\0';
+
+    std::string out;
+    message(out, 'E', body);
+    if (out.size() > conn->client_out.space()) {
+        close_connection(conn);
+        return false;
+    }
+    pool_to_client(conn, out.data(), out.size());
+    conn->pool_phase = Connection::PoolPhase::Closing;
+
+    if (write_side(conn, true) == -1) return false;
+    if (conn->client_out.empty()) {
+        close_connection(conn);
+        return false;
+    }
+    return true;
+}
+
+bool Proxy::pool_attach(Connection* conn) {
+    if (pool_idle_.empty()) {
+        conn->pool_waiting = true;
+        pool_waiters_.push_back(conn);
+        return false;
+    }
+
+    ServerLink* link = pool_idle_.back();
+    pool_idle_.pop_back();
+    link->state = ServerLink::State::Active;
+    link->client = conn;
+    conn->link = link;
+    return true;
+}
+
+void Proxy::pool_release(ServerLink* link) {
+    Connection* conn = link->client;
+    conn->link = nullptr;
+    link->client = nullptr;
+    link->state = ServerLink::State::Idle;
+    pool_lend(link);
+
+    //  Client might have been reading only as fast as this link let it
+    if (!conn->closed) pool_refresh(conn);
+}
+
+//  Idle backend to the longest waiting client, or back to the idle list
+void Proxy::pool_lend(ServerLink* link) {
+    while (!pool_waiters_.empty()) {
+        Connection* conn = pool_waiters_.front();
+        pool_waiters_.pop_front();
+        conn->pool_waiting = false;
+
+        link->state = ServerLink::State::Active;
+        link->client = conn;
+        conn->link = link;
+
+        if (pool_client_frame(conn)) pool_refresh(conn);
+        return;
+    }
+
+    pool_idle_.push_back(link);
+}
+
+void Proxy::pool_forward(Connection* conn, ServerLink* link, const char* msg, std::size_t len) {
+    const char* body = msg + 5;
+    std::size_t body_len = len - 5;
+    std::size_t pos = 0;
+
+    switch (msg[0]) {
+        case 'P': {
+            std::string name(cstring(body, body_len, pos));
+            std::uint64_t hash = 0;
+            if (!name.empty()) {
+                hash = parse_hash(msg, len);
+                PooledStatement& kept = conn->prepared[name];
+                kept.hash = hash;
+                kept.parse.assign(msg, len);
+                if (link->prepared.count(name)) pool_close_statement(link, name);
+                link->prepared[name] = hash;
+            }
+            link->expect.push_back({ '1', false, link->syncs_sent, std::move(name), hash });
+            link->batch_open = true;
+            break;
+        }
+        case 'B': {
+            cstring(body, body_len, pos);  //  Portal
+            std::string name(cstring(body, body_len, pos));
+            if (!name.empty()) pool_ensure_statement(conn, link, name);
+            link->batch_open = true;
+            break;
+        }
+        case 'D': {
+            if (body_len > 0 && body[0] == 'S') {
+                pos = 1;
+                std::string name(cstring(body, body_len, pos));
+                if (!name.empty()) pool_ensure_statement(conn, link, name);
+            }
+            link->batch_open = true;
+            break;
+        }
+        case 'C': {
+            std::string name;
+            if (body_len > 0 && body[0] == 'S') {
+                pos = 1;
+                name = cstring(body, body_len, pos);
+                conn->prepared.erase(name);
+                link->prepared.erase(name);
+            }
+            link->expect.push_back({ '3', false, link->syncs_sent, std::move(name), 0 });
+            link->batch_open = true;
+            break;
+        }
+        case 'Q':
+        case 'S':
+        case 'F':
+            link->syncs_sent++;
+            link->batch_open = false;
+            break;
+        case 'H':
+        case 'd':
+        case 'c':
+        case 'f':
+            break;  //  Flush and COPY data belong to whatever is running
+        default:
+            link->batch_open = true;
+            break;
+    }
+
+    link->out.append(msg, len);
+}
+
+//  Backend lacks the client's statement, or has another one by that name
+void Proxy::pool_ensure_statement(Connection* conn, ServerLink* link, const std::string& name) {
+    auto kept = conn->prepared.find(name);
+    if (kept == conn->prepared.end()) return;  //  Not ours to fix, the server reports it
+
+    auto have = link->prepared.find(name);
+    if (have != link->prepared.end()) {
+        if (have->second == kept->second.hash) return;
+        pool_close_statement(link, name);
+    }
+
+    link->out += kept->second.parse;
+    link->prepared[name] = kept->second.hash;
+    link->expect.push_back({ '1', true, link->syncs_sent, name, kept->second.hash });
+}
+
+void Proxy::pool_close_statement(ServerLink* link, const std::string& name) {
+    std::string body = "S" + name;
+    body += '\0';
+    message(link->out, 'C', body);
+    link->prepared.erase(name);
+    link->expect.push_back({ '3', true, link->syncs_sent, name, 0 });
+}
+
+//  Callers check ring space first
+void Proxy::pool_to_client(Connection* conn, const char* data, std::size_t len) {
+    std::size_t n = conn->client_out.write(data, len);
+    if (interceptor_) {
+        PROFILE_SCOPE(kInterceptServer);
+        interceptor_->onServerData(*conn, data, n);
+    }
+}
+
+void Proxy::pool_client_closed(Connection* conn) {
+    if (conn->pool_waiting) {
+        pool_waiters_.erase(std::find(pool_waiters_.begin(), pool_waiters_.end(), conn));
+        conn->pool_waiting = false;
+    }
+
+    if (conn->pool_phase == Connection::PoolPhase::Greeting) {
+        auto it = std::find(pool_greeters_.begin(), pool_greeters_.end(), conn);
+        if (it != pool_greeters_.end()) pool_greeters_.erase(it);
+    }
+
+    //  Left inside a transaction or batch, the backend state is unknown
+    if (ServerLink* link = conn->link) {
+        conn->link = nullptr;
+        link->client = nullptr;
+        pool_link_down(link);
+    }
+}
+
+void Proxy::pool_refresh(Connection* conn) {
+    if (conn->closed) return;
+    update_epoll_events(conn->client_fd, pool_client_wants_read(conn), !conn->client_out.empty());
+    if (conn->link) pool_refresh_link(conn->link);
+}
+
+void Proxy::pool_refresh_link(ServerLink* link) {
+    if (link->fd == -1) return;
+    bool connecting = link->state == ServerLink::State::Connecting;
+    bool want_write = connecting || link->out_off < link->out.size();
+    bool want_read = !connecting && pool_link_room(link) > 0;
+    update_epoll_events(link->fd, want_read, want_write);
+}
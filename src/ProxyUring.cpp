@@ -0,0 +1,587 @@
+#include "Proxy.h"
+
+#include <algorithm>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+
+#include "Profile.h"
+
+//  io_uring reactor: same Connection pool, interceptor and water marks as
+//  the epoll loop, but recv/send/accept/connect are completions:
+//    accept   - one multishot sqe for all clients
+//    recv     - multishot, kernel picks one of the provided buffers,
+//               the same buffer is then sent to the peer, no copy
+//    send     - queued buffers go out as one sendmsg, in order
+//  Sockets stay blocking here, io_uring parks them on poll internally
+
+namespace {
+
+enum UringOp : uint64_t {
+    OP_INTERNAL = 0,  //  IoUring own sqes, completes only on failure
+    OP_ACCEPT,
+    OP_WAKEUP,
+    OP_TIMEOUT,
+    OP_CANCEL,
+    OP_CONNECT,
+    OP_RECV_CLIENT,
+    OP_RECV_SERVER,
+    OP_SEND_CLIENT,
+    OP_SEND_SERVER,
+};
+
+constexpr uint64_t kOpMask = 0xF;        //  Connection is 16-byte aligned
+constexpr std::uint16_t kBufGroup = 0;
+
+uint64_t tag(Connection* conn, UringOp op) {
+    return reinterpret_cast<uint64_t>(conn) | op;
+}
+
+bool clear_nonblocking(int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags == -1) return false;
+    return fcntl(fd, F_SETFL, flags & ~O_NONBLOCK) != -1;
+}
+
+//  Reply spans several buffers, Nagle would hold the tail for a delayed ACK
+void set_nodelay(int fd) {
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+}
+
+}  // namespace
+
+bool Proxy::run_uring() {
+    //  bid is 16 bit
+    unsigned buffers = options_.uring_buffers;
+    if (buffers == 0 || buffers > 65535) return false;
+
+    auto ring = std::make_unique<IoUring>();
+    if (!ring->init(options_.uring_entries)) return false;
+    if (!ring->provideBuffers(kBufGroup, buffers, options_.uring_buffer_size)) return false;
+
+    if (!clear_nonblocking(listener_fd_)) return false;
+
+    uring_ = std::move(ring);
+    uring_running_ = true;
+    std::cout << "IO: io_uring worker=" << options_.worker_id << "\n";
+
+    uring_arm_accept();
+    uring_arm_wakeup();
+
+    while (uring_running_) {
+        bool retries = !uring_unsent_.empty() || !uring_uncancelled_.empty() || uring_->hasUnrecycled();
+        if ((!budget_waiters_.empty() || retries) && !uring_timeout_armed_) {
+            uring_arm_timeout();  //  Budget may be freed by other workers, sqe-less ops retried
+        }
+
+        if (uring_->submitAndWait(1) < 0) {
+            perror("io_uring_enter");
+            break;
+        }
+        std::uint64_t busy_start = options_.metrics ? WorkerMetrics::now() : 0;
+
+        while (io_uring_cqe* cqe = uring_->peekCqe()) {
+            io_uring_cqe copy = *cqe;
+            uring_->advance(1);
+            uring_handle(&copy);
+        }
+
+        uring_resume_waiters();
+        reclaim_closed_connections();
+
+        if (options_.metrics) options_.metrics->loop_ns.record(WorkerMetrics::now() - busy_start);
+    }
+
+    return true;
+}
+
+void Proxy::uring_handle(io_uring_cqe* cqe) {
+    auto op = static_cast<UringOp>(cqe->user_data & kOpMask);
+    auto* conn = reinterpret_cast<Connection*>(cqe->user_data & ~kOpMask);
+
+    switch (op) {
+        case OP_INTERNAL:
+            if (cqe->res < 0) {
+                errno = -cqe->res;
+                perror("provide buffers");
+            }
+            break;
+        case OP_ACCEPT:
+            uring_on_accept(cqe->res, cqe->flags);
+            break;
+        case OP_WAKEUP:
+            uring_running_ = false;
+            break;
+        case OP_TIMEOUT:
+            uring_timeout_armed_ = false;
+            break;
+        case OP_CANCEL:
+            break;
+        case OP_CONNECT:
+            uring_on_connect(conn, cqe->res);
+            break;
+        case OP_RECV_CLIENT:
+        case OP_RECV_SERVER:
+            uring_on_recv(conn, op == OP_RECV_CLIENT, cqe->res, cqe->flags);
+            break;
+        case OP_SEND_CLIENT:
+        case OP_SEND_SERVER:
+            uring_on_send(conn, op == OP_SEND_CLIENT, cqe->res);
+            break;
+    }
+}
+
+void Proxy::uring_arm_accept() {
+    io_uring_sqe* sqe = uring_->getSqe();
+    if (!sqe) return;
+
+    //  Peer address comes from getpeername, multishot has no per-accept addr
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = listener_fd_;
+    sqe->accept_flags = SOCK_CLOEXEC;
+    sqe->ioprio = uring_multishot_accept_ ? IORING_ACCEPT_MULTISHOT : 0;
+    sqe->user_data = OP_ACCEPT;
+}
+
+void Proxy::uring_arm_wakeup() {
+    io_uring_sqe* sqe = uring_->getSqe();
+    if (!sqe) return;
+
+    //  Poll, not read: eventfd is O_NONBLOCK and read would complete with EAGAIN
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = wakeup_fd_;
+    sqe->poll32_events = POLLIN;
+    sqe->user_data = OP_WAKEUP;
+}
+
+void Proxy::uring_arm_timeout() {
+    static __kernel_timespec ts{ 0, 10 * 1000 * 1000 };
+
+    io_uring_sqe* sqe = uring_->getSqe();
+    if (!sqe) return;
+
+    sqe->opcode = IORING_OP_TIMEOUT;
+    sqe->addr = reinterpret_cast<uint64_t>(&ts);
+    sqe->len = 1;
+    sqe->user_data = OP_TIMEOUT;
+    uring_timeout_armed_ = true;
+}
+
+void Proxy::uring_arm_recv(Connection* conn, bool is_client) {
+    UringSide& side = is_client ? conn->uring_client : conn->uring_server;
+    if (side.recv_armed || conn->closed) return;
+
+    io_uring_sqe* sqe = uring_->getSqe();
+    if (!sqe) return;
+
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = is_client ? conn->client_fd : conn->server_fd;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = kBufGroup;
+    if (uring_multishot_recv_) {
+        sqe->ioprio = IORING_RECV_MULTISHOT;
+    } else {
+        sqe->len = static_cast<uint32_t>(uring_->bufferSize());
+    }
+    sqe->user_data = tag(conn, is_client ? OP_RECV_CLIENT : OP_RECV_SERVER);
+
+    side.recv_armed = true;
+    conn->uring_ops++;
+}
+
+//  Every pending op of the link completes with -ECANCELED
+//  By user_data, one op per tag is in flight; works on every kernel, unlike CANCEL_FD (5.19)
+void Proxy::uring_cancel(Connection* conn) {
+    UringOp ops[5];
+    unsigned n = 0;
+    if (conn->uring_client.recv_armed) ops[n++] = OP_RECV_CLIENT;
+    if (conn->uring_server.recv_armed) ops[n++] = OP_RECV_SERVER;
+    if (conn->uring_client.sending > 0) ops[n++] = OP_SEND_CLIENT;
+    if (conn->uring_server.sending > 0) ops[n++] = OP_SEND_SERVER;
+    if (!conn->server_connected) ops[n++] = OP_CONNECT;
+
+    //  All or none, a dropped cancel would keep the link open forever
+    if (!uring_->reserve(n)) {
+        if (!conn->cancel_retry) {
+            conn->cancel_retry = true;
+            uring_uncancelled_.push_back(conn);
+        }
+        return;
+    }
+    conn->cancel_retry = false;
+
+    for (unsigned i = 0; i < n; i++) {
+        io_uring_sqe* sqe = uring_->getSqe();
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->addr = tag(conn, ops[i]);
+        sqe->user_data = OP_CANCEL;
+    }
+}
+
+void Proxy::uring_on_accept(int res, uint32_t flags) {
+    if (res < 0) {
+        if (res == -EINVAL && uring_multishot_accept_) {
+            uring_multishot_accept_ = false;  //  Kernel < 5.19, one sqe per accept
+        } else if (res != -ECANCELED) {
+            errno = -res;
+            perror("accept");
+        }
+    } else {
+        int client_fd = res;
+        int server_fd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (server_fd == -1) {
+            perror("socket");
+            close(client_fd);
+        } else {
+            Connection* conn = acquire_connection();
+            conn->id = next_id();
+
+            //  Add addr
+            sockaddr_in client_addr{};
+            socklen_t client_len = sizeof(client_addr);
+            getpeername(client_fd, reinterpret_cast<sockaddr*>(&client_addr), &client_len);
+            char addrbuf[64];
+            inet_ntop(AF_INET, &client_addr.sin_addr, addrbuf, sizeof(addrbuf));
+            conn->client_addr = std::string(addrbuf) + ":" + std::to_string(ntohs(client_addr.sin_port));
+            conn->server_addr = dbs_host_ + ":" + std::to_string(dbs_port_);
+
+            conn->client_fd = client_fd;
+            conn->server_fd = server_fd;
+            conn->server_connected = false;
+            set_nodelay(client_fd);
+            set_nodelay(server_fd);
+
+            std::cout << "New link: client_fd=" << client_fd << " server_fd=" << server_fd << "\n";
+            if (options_.metrics) WorkerMetrics::add(options_.metrics->accepted);
+
+            //  No connect = nothing would ever move this link, drop it
+            io_uring_sqe* sqe = uring_->getSqe();
+            if (!sqe) {
+                std::cerr << "No sqe for connect, closing client_fd=" << client_fd << "\n";
+                uring_close(conn);
+            } else {
+                sqe->opcode = IORING_OP_CONNECT;
+                sqe->fd = server_fd;
+                sqe->addr = reinterpret_cast<uint64_t>(&db_addr_);
+                sqe->off = sizeof(db_addr_);
+                sqe->user_data = tag(conn, OP_CONNECT);
+                conn->uring_ops++;
+
+                //  Client may talk right away, bytes wait in queue until connect is done
+                uring_arm_recv(conn, true);
+            }
+        }
+    }
+
+    if (!(flags & IORING_CQE_F_MORE) && uring_running_) {
+        uring_arm_accept();
+    }
+}
+
+void Proxy::uring_on_connect(Connection* conn, int res) {
+    conn->uring_ops--;
+
+    if (conn->closed) {
+        if (conn->uring_ops == 0) uring_finalize(conn);
+        return;
+    }
+
+    if (res < 0) {
+        errno = -res;
+        perror("connect");
+        uring_close(conn);
+        return;
+    }
+
+    conn->server_connected = true;
+    uring_arm_recv(conn, false);
+    uring_submit_sends(conn, false);
+}
+
+void Proxy::uring_on_recv(Connection* conn, bool is_client, int res, uint32_t flags) {
+    UringSide& side = is_client ? conn->uring_client : conn->uring_server;
+    UringSide& peer = is_client ? conn->uring_server : conn->uring_client;
+
+    if (!(flags & IORING_CQE_F_MORE)) {
+        side.recv_armed = false;
+        conn->uring_ops--;
+    }
+
+    if (res > 0 && (flags & IORING_CQE_F_BUFFER)) {
+        auto bid = static_cast<std::uint16_t>(flags >> IORING_CQE_BUFFER_SHIFT);
+
+        if (conn->closed) {
+            uring_->recycleBuffer(bid);
+            uring_buffers_recycled_ = true;
+        } else {
+            std::size_t len = static_cast<std::size_t>(res);
+            if (options_.metrics) {
+                WorkerMetrics::add(is_client ? options_.metrics->bytes_c2s : options_.metrics->bytes_s2c, len);
+            }
+
+            //  Interceptor GO
+            if (interceptor_) {
+                const char* data = uring_->buffer(bid);
+                if (is_client) {
+                    PROFILE_SCOPE(kInterceptClient);
+                    interceptor_->onClientData(*conn, data, len);
+                } else {
+                    PROFILE_SCOPE(kInterceptServer);
+                    interceptor_->onServerData(*conn, data, len);
+                }
+            }
+
+            //  Routing: same buffer goes to the peer
+            peer.queue.push_back(UringChunk{ bid, static_cast<std::uint32_t>(len) });
+            peer.bytes += len;
+            if (options_.budget) options_.budget->charge(len);
+
+            uring_submit_sends(conn, !is_client);
+            uring_pause_check(conn, is_client);
+        }
+    } else if (res == 0 && !conn->closed) {
+        std::cerr << "Received EOF on fd=" << (is_client ? conn->client_fd : conn->server_fd)
+                  << " role=" << (is_client ? "client" : "server") << "\n";
+        uring_close(conn);
+    } else if (res < 0 && !conn->closed) {
+        if (res == -ENOBUFS) {
+            //  Provided buffers ran dry, retry once sends give some back
+            if (!side.paused) {
+                side.paused = true;
+                uring_starved_.push_back(conn);
+            }
+        } else if (res == -EINVAL && uring_multishot_recv_) {
+            uring_multishot_recv_ = false;  //  Kernel < 6.0, re-armed per completion
+        } else if (res != -ECANCELED) {
+            errno = -res;
+            perror("recv");
+            uring_close(conn);
+        }
+    }
+
+    if (conn->closed) {
+        if (conn->uring_ops == 0) uring_finalize(conn);
+        return;
+    }
+
+    if (!side.recv_armed && !side.paused) {
+        uring_arm_recv(conn, is_client);
+    }
+}
+
+void Proxy::uring_submit_sends(Connection* conn, bool to_client) {
+    PROFILE_SCOPE(kSend);
+    UringSide& dst = to_client ? conn->uring_client : conn->uring_server;
+    if (conn->closed || dst.sending > 0 || dst.queue.empty()) return;
+    if (!to_client && !conn->server_connected) return;
+
+    //  SQ stuck: retried after the next submit, nothing else would resend these
+    io_uring_sqe* sqe = uring_->getSqe();
+    if (!sqe) {
+        if (!dst.send_retry) {
+            dst.send_retry = true;
+            uring_unsent_.push_back(conn);
+        }
+        return;
+    }
+    dst.send_retry = false;
+
+    //  One sendmsg for all queued chunks, MSG_WAITALL on a blocking socket sends all or fails
+    unsigned n = static_cast<unsigned>(std::min<std::size_t>(dst.queue.size(), UringSide::kSendIov));
+    dst.sending_bytes = 0;
+    for (unsigned i = 0; i < n; i++) {
+        const UringChunk& chunk = dst.queue[i];
+        dst.iov[i] = { uring_->buffer(chunk.bid), chunk.len };
+        dst.sending_bytes += chunk.len;
+    }
+    dst.msg = {};
+    dst.msg.msg_iov = dst.iov;
+    dst.msg.msg_iovlen = n;
+
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = to_client ? conn->client_fd : conn->server_fd;
+    sqe->addr = reinterpret_cast<uint64_t>(&dst.msg);
+    sqe->len = 1;
+    sqe->msg_flags = MSG_WAITALL | MSG_NOSIGNAL;
+    sqe->user_data = tag(conn, to_client ? OP_SEND_CLIENT : OP_SEND_SERVER);
+    conn->uring_ops++;
+
+    dst.sending = n;
+}
+
+void Proxy::uring_on_send(Connection* conn, bool to_client, int res) {
+    UringSide& dst = to_client ? conn->uring_client : conn->uring_server;
+    conn->uring_ops--;
+
+    //  Whole in-flight head of the queue went out in this one
+    for (unsigned i = 0; i < dst.sending; i++) {
+        uring_->recycleBuffer(dst.queue.front().bid);
+        dst.queue.pop_front();
+    }
+    dst.sending = 0;
+    uring_buffers_recycled_ = true;
+
+    if (!conn->closed) {
+        dst.bytes -= dst.sending_bytes;
+        if (options_.budget) options_.budget->refund(dst.sending_bytes);
+
+        if (res < 0 || static_cast<std::size_t>(res) != dst.sending_bytes) {
+            if (res < 0) {
+                errno = -res;
+                perror("send");
+            } else {
+                std::cerr << "Short send on fd=" << (to_client ? conn->client_fd : conn->server_fd) << "\n";
+            }
+            uring_close(conn);
+        }
+    }
+
+    if (conn->closed) {
+        if (conn->uring_ops == 0) uring_finalize(conn);
+        return;
+    }
+
+    uring_submit_sends(conn, to_client);
+
+    //  Peer drained, maybe the side feeding it can read again
+    uring_resume_check(conn, !to_client);
+}
+
+//  Source side over high mark or budget: stop its recv until drained
+void Proxy::uring_pause_check(Connection* conn, bool is_client) {
+    UringSide& side = is_client ? conn->uring_client : conn->uring_server;
+    UringSide& peer = is_client ? conn->uring_server : conn->uring_client;
+    std::size_t high = is_client ? c2s_high_ : s2c_high_;
+
+    bool over_budget = options_.budget && options_.budget->available() == 0;
+    if (peer.bytes < high && !over_budget) return;
+    if (side.paused) return;
+
+    side.paused = true;
+    if (over_budget && !conn->budget_wait) {
+        conn->budget_wait = true;
+        budget_waiters_.push_back(conn);
+    }
+
+    //  Multishot keeps firing until cancelled
+    if (side.recv_armed && uring_multishot_recv_) {
+        io_uring_sqe* sqe = uring_->getSqe();
+        if (!sqe) return;
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->addr = tag(conn, is_client ? OP_RECV_CLIENT : OP_RECV_SERVER);
+        sqe->user_data = OP_CANCEL;
+    }
+}
+
+void Proxy::uring_resume_check(Connection* conn, bool is_client) {
+    UringSide& side = is_client ? conn->uring_client : conn->uring_server;
+    UringSide& peer = is_client ? conn->uring_server : conn->uring_client;
+    std::size_t low = is_client ? c2s_low_ : s2c_low_;
+
+    if (conn->closed || !side.paused || conn->budget_wait) return;
+    if (peer.bytes > low) return;
+
+    side.paused = false;
+    uring_arm_recv(conn, is_client);
+}
+
+void Proxy::uring_resume_waiters() {
+    uring_->retryRecycles();
+
+    if (!uring_uncancelled_.empty()) {
+        std::vector<Connection*> uncancelled;
+        uncancelled.swap(uring_uncancelled_);
+        for (Connection* conn : uncancelled) {
+            conn->cancel_retry = false;
+            uring_cancel(conn);
+        }
+    }
+
+    if (!uring_unsent_.empty()) {
+        std::vector<Connection*> unsent;
+        unsent.swap(uring_unsent_);
+        for (Connection* conn : unsent) {
+            bool to_client = conn->uring_client.send_retry;
+            bool to_server = conn->uring_server.send_retry;
+            conn->uring_client.send_retry = conn->uring_server.send_retry = false;
+            if (to_client) uring_submit_sends(conn, true);
+            if (to_server) uring_submit_sends(conn, false);
+        }
+    }
+
+    if (uring_buffers_recycled_ && !uring_starved_.empty()) {
+        std::vector<Connection*> starved;
+        starved.swap(uring_starved_);
+        for (Connection* conn : starved) {
+            uring_resume_check(conn, true);
+            uring_resume_check(conn, false);
+        }
+    }
+    uring_buffers_recycled_ = false;
+
+    if (budget_waiters_.empty() || !options_.budget || options_.budget->available() == 0) return;
+
+    std::vector<Connection*> waiters;
+    waiters.swap(budget_waiters_);
+    for (Connection* conn : waiters) {
+        conn->budget_wait = false;
+        uring_resume_check(conn, true);
+        uring_resume_check(conn, false);
+    }
+}
+
+//  Stop using the link now, sockets are closed once every op has completed
+void Proxy::uring_close(Connection* conn) {
+    if (conn->closed) return;
+    conn->closed = true;
+    if (options_.metrics) WorkerMetrics::add(options_.metrics->closed);
+
+    if (options_.budget) {
+        options_.budget->refund(conn->uring_client.bytes + conn->uring_server.bytes);
+    }
+    conn->uring_client.bytes = conn->uring_server.bytes = 0;
+
+    if (interceptor_) {
+        interceptor_->onConnectionClosed(*conn);
+    }
+    conn->interceptor_state = nullptr;
+
+    //  Not yet submitted chunks go straight back, in-flight ones on completion
+    for (UringSide* side : { &conn->uring_client, &conn->uring_server }) {
+        for (std::size_t i = side->sending; i < side->queue.size(); i++) {
+            uring_->recycleBuffer(side->queue[i].bid);
+            uring_buffers_recycled_ = true;
+        }
+        side->queue.resize(side->sending);
+    }
+
+    uring_cancel(conn);
+
+    if (conn->uring_ops == 0) uring_finalize(conn);
+}
+
+void Proxy::uring_finalize(Connection* conn) {
+    if (conn->client_fd != -1) {
+        close(conn->client_fd);
+        conn->client_fd = -1;
+    }
+    if (conn->server_fd != -1) {
+        close(conn->server_fd);
+        conn->server_fd = -1;
+    }
+
+    auto it = std::find(uring_starved_.begin(), uring_starved_.end(), conn);
+    if (it != uring_starved_.end()) uring_starved_.erase(it);
+    it = std::find(uring_unsent_.begin(), uring_unsent_.end(), conn);
+    if (it != uring_unsent_.end()) uring_unsent_.erase(it);
+    it = std::find(uring_uncancelled_.begin(), uring_uncancelled_.end(), conn);
+    if (it != uring_uncancelled_.end()) uring_uncancelled_.erase(it);
+    conn->cancel_retry = false;
+
+    conn->uring_client = UringSide();
+    conn->uring_server = UringSide();
+    conn->server_connected = false;
+
+    closed_connections_.push_back(conn);
+}
@@ -17,6 +17,8 @@ public:
 
     void onServerData(Connection& conn, const char* data, std::size_t len) override;
 
+    bool needsServerData() const override { return true; }
+
 private:
     std::ofstream file_;
 
@@ -0,0 +1,140 @@
+#include "RingBuffer.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+
+static std::size_t round_up_pow2(std::size_t value) {
+    std::size_t size = 1;
+    while (size < value) {
+        size <<= 1;
+    }
+    return size;
+}
+
+RingBuffer::RingBuffer(std::size_t capacity) {
+    setCapacity(capacity);
+}
+
+void RingBuffer::setCapacity(std::size_t capacity) {
+    if (!empty()) return;
+
+    std::size_t rounded = capacity ? round_up_pow2(capacity) : 0;
+    if (rounded != capacity_) {
+        data_.reset();
+        allocated_ = false;
+        capacity_ = rounded;
+    }
+    read_pos_ = write_pos_ = 0;
+}
+
+void RingBuffer::release() {
+    if (!empty()) return;
+
+    data_.reset();
+    allocated_ = false;
+    read_pos_ = write_pos_ = 0;
+}
+
+//  Free region [write, read + capacity), split at the end of storage
+int RingBuffer::freeSpans(iovec iov[2], std::size_t max) {
+    std::size_t avail = std::min(space(), max);
+    if (avail == 0) return 0;
+
+    if (!allocated_) {
+        data_.reset(new char[capacity_]);
+        allocated_ = true;
+    }
+
+    std::size_t start = static_cast<std::size_t>(write_pos_) & (capacity_ - 1);
+    std::size_t first = std::min(avail, capacity_ - start);
+
+    iov[0].iov_base = data_.get() + start;
+    iov[0].iov_len = first;
+    if (first == avail) return 1;
+
+    iov[1].iov_base = data_.get();
+    iov[1].iov_len = avail - first;
+    return 2;
+}
+
+//  Used region [read, write), split at the end of storage
+int RingBuffer::usedSpans(iovec iov[2]) const {
+    std::size_t used = size();
+    if (used == 0) return 0;
+
+    std::size_t start = static_cast<std::size_t>(read_pos_) & (capacity_ - 1);
+    std::size_t first = std::min(used, capacity_ - start);
+
+    iov[0].iov_base = data_.get() + start;
+    iov[0].iov_len = first;
+    if (first == used) return 1;
+
+    iov[1].iov_base = data_.get();
+    iov[1].iov_len = used - first;
+    return 2;
+}
+
+ssize_t RingBuffer::readFrom(int fd, iovec filled[2], int& nfilled, std::size_t max) {
+    nfilled = 0;
+
+    iovec iov[2];
+    int cnt = freeSpans(iov, max);
+    if (cnt == 0) {
+        errno = ENOBUFS;
+        return -1;
+    }
+
+    ssize_t n = ::readv(fd, iov, cnt);
+    if (n <= 0) return n;
+
+    //  Tell caller where new bytes landed
+    std::size_t left = static_cast<std::size_t>(n);
+    for (int i = 0; i < cnt && left > 0; i++) {
+        filled[i].iov_base = iov[i].iov_base;
+        filled[i].iov_len = std::min(left, iov[i].iov_len);
+        left -= filled[i].iov_len;
+        nfilled++;
+    }
+
+    write_pos_ += static_cast<std::uint64_t>(n);
+    return n;
+}
+
+std::size_t RingBuffer::write(const char* data, std::size_t len) {
+    iovec iov[2];
+    int cnt = freeSpans(iov, len);
+
+    std::size_t copied = 0;
+    for (int i = 0; i < cnt; i++) {
+        std::memcpy(iov[i].iov_base, data + copied, iov[i].iov_len);
+        copied += iov[i].iov_len;
+    }
+
+    write_pos_ += static_cast<std::uint64_t>(copied);
+    return copied;
+}
+
+ssize_t RingBuffer::writeTo(int fd) {
+    ssize_t total = 0;
+
+    while (!empty()) {
+        iovec iov[2];
+        int cnt = usedSpans(iov);
+
+        ssize_t n = ::writev(fd, iov, cnt);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return total;
+            return -1;
+        }
+
+        read_pos_ += static_cast<std::uint64_t>(n);
+        total += n;
+    }
+
+    //  Rewind, so next burst starts at offset 0 and stays in one span
+    read_pos_ = write_pos_ = 0;
+    return total;
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+//  Fixed-capacity byte ring, one per direction of a link
+//  recv/send go straight into/out of the ring with readv/writev,
+//  wrap-around costs one more iovec instead of a copy or a memmove
+//  Storage is allocated on first use, idle links cost nothing
+
+class RingBuffer {
+public:
+    explicit RingBuffer(std::size_t capacity = 0);
+
+    //  Rounded up to power of 2, only allowed while empty
+    void setCapacity(std::size_t capacity);
+
+    std::size_t size()     const { return static_cast<std::size_t>(write_pos_ - read_pos_); }
+    std::size_t capacity() const { return capacity_; }
+    std::size_t space()    const { return capacity_ - size(); }
+    bool empty() const { return write_pos_ == read_pos_; }
+    bool full()  const { return size() == capacity_; }
+    std::size_t allocatedBytes() const { return allocated_ ? capacity_ : 0; }
+
+    //  recv into free space, at most max bytes
+    //  Filled bytes are reported as up to 2 spans, so caller can inspect them
+    ssize_t readFrom(int fd, iovec filled[2], int& nfilled, std::size_t max = SIZE_MAX);
+
+    //  Copy into free space, returns bytes taken, short when the ring fills
+    std::size_t write(const char* data, std::size_t len);
+
+    //  send as much as socket takes, returns bytes sent or -1 with errno
+    ssize_t writeTo(int fd);
+
+    //  Drop storage if nothing is buffered
+    void release();
+
+    //  Forget buffered bytes, storage is kept
+    void clear() { read_pos_ = write_pos_ = 0; }
+
+private:
+    std::unique_ptr<char[]> data_;
+    std::size_t capacity_ = 0;
+    bool allocated_ = false;
+
+    //  Monotonic positions, index is pos & (capacity_ - 1)
+    std::uint64_t read_pos_  = 0;
+    std::uint64_t write_pos_ = 0;
+
+    int freeSpans(iovec iov[2], std::size_t max);
+    int usedSpans(iovec iov[2]) const;
+};
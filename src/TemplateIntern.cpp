@@ -0,0 +1,78 @@
+#include "TemplateIntern.h"
+
+TemplateIntern& TemplateIntern::shared() {
+    static TemplateIntern instance;
+    return instance;
+}
+
+TemplateIntern::~TemplateIntern() {
+    for (Shard& shard : shards_) {
+        for (auto& [text, entry] : shard.map) {
+            delete entry;
+        }
+    }
+}
+
+std::uint64_t TemplateIntern::fingerprint(std::string_view text) {
+    std::uint64_t hash = 14695981039346656037ull;
+    for (unsigned char c : text) {
+        hash ^= c;
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+TemplateIntern::Ref TemplateIntern::intern(std::string_view text) {
+    std::uint64_t fp = fingerprint(text);
+    Shard& shard = shardFor(fp);
+
+    std::lock_guard<std::mutex> lock(shard.mutex);
+
+    auto it = shard.map.find(text);
+    if (it != shard.map.end()) {
+        it->second->refs.fetch_add(1, std::memory_order_relaxed);
+        return Ref(it->second);
+    }
+
+    if (shard.maybe_dead.load(std::memory_order_relaxed) >= kSweepAfter) {
+        sweep(shard);
+    }
+
+    Entry* entry = new Entry();
+    entry->text.assign(text);
+    entry->fingerprint = fp;
+    entry->refs.store(1, std::memory_order_relaxed);
+    shard.map.emplace(std::string_view(entry->text), entry);
+
+    entries_.fetch_add(1, std::memory_order_relaxed);
+    bytes_.fetch_add(sizeof(Entry) + entry->text.capacity(), std::memory_order_relaxed);
+    return Ref(entry);
+}
+
+void TemplateIntern::release(Entry* entry) {
+    if (!entry) return;
+
+    //  Read before the drop, entry may be swept right after it
+    Shard& shard = shardFor(entry->fingerprint);
+    if (entry->refs.fetch_sub(1, std::memory_order_acq_rel) != 1) return;
+
+    shard.maybe_dead.fetch_add(1, std::memory_order_relaxed);
+}
+
+//  Called with shard lock held
+void TemplateIntern::sweep(Shard& shard) {
+    shard.maybe_dead.store(0, std::memory_order_relaxed);
+
+    for (auto it = shard.map.begin(); it != shard.map.end();) {
+        Entry* entry = it->second;
+        if (entry->refs.load(std::memory_order_acquire) != 0) {
+            ++it;
+            continue;
+        }
+
+        entries_.fetch_sub(1, std::memory_order_relaxed);
+        bytes_.fetch_sub(sizeof(Entry) + entry->text.capacity(), std::memory_order_relaxed);
+        it = shard.map.erase(it);
+        delete entry;
+    }
+}
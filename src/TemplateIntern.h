@@ -0,0 +1,77 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+//  Process-wide table of prepared statement texts, shared by all workers
+//  Thousands of links Parse the same few statements, each text is kept once
+//  Entries are refcounted, unused ones are swept lazily under the shard lock
+
+class TemplateIntern {
+public:
+    struct Entry {
+        std::string text;
+        std::uint64_t fingerprint = 0;
+        std::atomic<std::uint32_t> refs{0};
+    };
+
+    //  One reference to a table entry, copy = one more reference
+    class Ref {
+    public:
+        Ref() = default;
+        Ref(const Ref& other) : entry_(other.entry_) { retain(); }
+        Ref(Ref&& other) noexcept : entry_(other.entry_) { other.entry_ = nullptr; }
+        Ref& operator=(Ref other) noexcept { std::swap(entry_, other.entry_); return *this; }
+        ~Ref() { TemplateIntern::shared().release(entry_); }
+
+        explicit operator bool() const { return entry_ != nullptr; }
+        std::string_view text() const { return entry_ ? std::string_view(entry_->text) : std::string_view(); }
+        std::uint64_t fingerprint() const { return entry_ ? entry_->fingerprint : 0; }
+
+    private:
+        friend class TemplateIntern;
+        explicit Ref(Entry* entry) : entry_(entry) {}
+        void retain() { if (entry_) entry_->refs.fetch_add(1, std::memory_order_relaxed); }
+
+        Entry* entry_ = nullptr;
+    };
+
+    static TemplateIntern& shared();
+
+    Ref intern(std::string_view text);
+
+    //  FNV-1a 64, stable across runs so log lines can be grouped offline
+    static std::uint64_t fingerprint(std::string_view text);
+
+    //  Stats, any thread
+    std::size_t entries() const { return entries_.load(std::memory_order_relaxed); }
+    std::size_t bytes() const { return bytes_.load(std::memory_order_relaxed); }
+
+private:
+    static constexpr std::size_t kShards = 64;
+    static constexpr std::size_t kSweepAfter = 256;  //  Dead candidates before a shard sweep
+
+    struct alignas(64) Shard {
+        std::mutex mutex;
+        std::unordered_map<std::string_view, Entry*> map;  //  Key views Entry::text
+        std::atomic<std::size_t> maybe_dead{0};
+    };
+
+    Shard shards_[kShards];
+    std::atomic<std::size_t> entries_{0};
+    std::atomic<std::size_t> bytes_{0};
+
+    TemplateIntern() = default;
+    ~TemplateIntern();
+
+    //  Last reference only marks the shard, entry stays until next sweep,
+    //  so a concurrent intern() of same text may pick it up again
+    void release(Entry* entry);
+    void sweep(Shard& shard);
+    Shard& shardFor(std::uint64_t fingerprint) { return shards_[fingerprint % kShards]; }
+};
@@ -0,0 +1,138 @@
+#include "TextScan.h"
+
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define TEXTSCAN_X86 1
+#endif
+
+namespace textscan {
+
+static const char kHexDigits[] = "0123456789abcdef";
+
+//  Scalar, reference for the vector versions
+static void appendHexScalar(char* out, const unsigned char* in, std::size_t n) {
+    for (std::size_t i = 0; i < n; i++) {
+        out[2 * i]     = kHexDigits[in[i] >> 4];
+        out[2 * i + 1] = kHexDigits[in[i] & 0x0F];
+    }
+}
+
+#ifdef TEXTSCAN_X86
+
+//  pshufb maps each nibble to its digit, unpack interleaves hi/lo
+__attribute__((target("sse4.2")))
+static void appendHexSse42(char* out, const unsigned char* in, std::size_t n) {
+    const __m128i lut = _mm_loadu_si128(reinterpret_cast<const __m128i*>(kHexDigits));
+    const __m128i low4 = _mm_set1_epi8(0x0F);
+
+    std::size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i x  = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+        __m128i hi = _mm_shuffle_epi8(lut, _mm_and_si128(_mm_srli_epi16(x, 4), low4));
+        __m128i lo = _mm_shuffle_epi8(lut, _mm_and_si128(x, low4));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 2 * i),      _mm_unpacklo_epi8(hi, lo));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 2 * i + 16), _mm_unpackhi_epi8(hi, lo));
+    }
+    appendHexScalar(out + 2 * i, in + i, n - i);
+}
+
+//  Shuffle and unpack work per 128-bit lane, permute puts lanes back in order
+__attribute__((target("avx2")))
+static void appendHexAvx2(char* out, const unsigned char* in, std::size_t n) {
+    const __m256i lut = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(kHexDigits)));
+    const __m256i low4 = _mm256_set1_epi8(0x0F);
+
+    std::size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m256i x  = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i));
+        __m256i hi = _mm256_shuffle_epi8(lut, _mm256_and_si256(_mm256_srli_epi16(x, 4), low4));
+        __m256i lo = _mm256_shuffle_epi8(lut, _mm256_and_si256(x, low4));
+        __m256i a  = _mm256_unpacklo_epi8(hi, lo);  //  bytes 0-7 | 16-23
+        __m256i b  = _mm256_unpackhi_epi8(hi, lo);  //  bytes 8-15 | 24-31
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + 2 * i),      _mm256_permute2x128_si256(a, b, 0x20));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + 2 * i + 32), _mm256_permute2x128_si256(a, b, 0x31));
+    }
+    appendHexSse42(out + 2 * i, in + i, n - i);
+}
+
+#endif
+
+//  Dispatch
+
+using HexFn = void (*)(char*, const unsigned char*, std::size_t);
+
+struct Kernels {
+    Level level;
+    HexFn hex;
+};
+
+static Kernels kernelsFor(Level level) {
+#ifdef TEXTSCAN_X86
+    if (level == Level::Avx2)  return { Level::Avx2,  appendHexAvx2 };
+    if (level == Level::Sse42) return { Level::Sse42, appendHexSse42 };
+#endif
+    return { Level::Scalar, appendHexScalar };
+}
+
+Level detected() {
+#ifdef TEXTSCAN_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return Level::Avx2;
+    if (__builtin_cpu_supports("sse4.2")) return Level::Sse42;
+#endif
+    return Level::Scalar;
+}
+
+static Kernels active = kernelsFor(detected());
+
+bool force(Level level) {
+    if (static_cast<int>(level) > static_cast<int>(detected())) return false;
+    active = kernelsFor(level);
+    return true;
+}
+
+Level level() {
+    return active.level;
+}
+
+const char* levelName(Level level) {
+    switch (level) {
+        case Level::Avx2:  return "avx2";
+        case Level::Sse42: return "sse4.2";
+        default:           return "scalar";
+    }
+}
+
+//  glibc memchr is vectorized and picks its width from cpuid itself,
+//  hand-written pcmpeqb loops measured slower on every size in bench-text
+const char* findByte(const char* begin, const char* end, char c) {
+    const void* hit = std::memchr(begin, c, static_cast<std::size_t>(end - begin));
+    return hit ? static_cast<const char*>(hit) : end;
+}
+
+//  Quotes are rare in real values: copy runs between them in bulk
+void appendQuoteEscaped(std::string& out, std::string_view s) {
+    const char* p = s.data();
+    const char* end = p + s.size();
+    while (p < end) {
+        const char* quote = findByte(p, end, '\'');
+        if (quote == end) {
+            out.append(p, static_cast<std::size_t>(end - p));
+            return;
+        }
+        out.append(p, static_cast<std::size_t>(quote - p) + 1);
+        out.push_back('\'');
+        p = quote + 1;
+    }
+}
+
+void appendHex(std::string& out, std::string_view s) {
+    std::size_t pos = out.size();
+    out.resize(pos + 2 * s.size());
+    active.hex(out.data() + pos, reinterpret_cast<const unsigned char*>(s.data()), s.size());
+}
+
+}  // namespace textscan
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+//  Byte kernels for query rendering: find a byte, double quotes, hex encode
+//  Hex has AVX2 / SSE4.2 / scalar versions, best one is picked once at startup
+//  from cpuid, compiler flags stay generic. Byte search is libc memchr
+
+namespace textscan {
+
+enum class Level {
+    Scalar,
+    Sse42,
+    Avx2
+};
+
+//  First c in [begin, end), end if none
+const char* findByte(const char* begin, const char* end, char c);
+
+//  out += s with every ' doubled, no surrounding quotes
+void appendQuoteEscaped(std::string& out, std::string_view s);
+
+//  out += lowercase hex of s, two chars per byte
+void appendHex(std::string& out, std::string_view s);
+
+//  What the dispatch runs now
+Level level();
+const char* levelName(Level level);
+
+//  Best level this cpu has
+Level detected();
+
+//  Pin a level, e.g. to compare against scalar. Not thread-safe,
+//  call before workers start. Returns false if cpu lacks it
+bool force(Level level);
+
+}  // namespace textscan
@@ -1,9 +1,54 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
 #include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
 #include <signal.h>
 
+#include "Metrics.h"
 #include "Proxy.h"
 #include "RawHexInterceptor.h"
 #include "PgQueryInterceptor.h"
+#include "Profile.h"
+#include "TemplateIntern.h"
+
+static void usage(const char* prog) {
+    std::cerr << "Usage: " << prog
+              << " <listen_host> <listen_port> <db_host> <db_port> [options]\n"
+              << "Options:\n"
+              << "  --workers N       reactor threads, each with own SO_REUSEPORT listener (default 1)\n"
+              << "  --buffer-size N   ring buffer bytes per link direction (default 65536, min 4096)\n"
+              << "  --splice          server -> client via splice(), off if interceptor needs server data\n"
+              << "  --pipe-size N     splice pipe capacity in bytes (default: kernel)\n"
+              << "  --c2s-high N      stop reading client when server side holds N bytes (default: buffer size)\n"
+              << "  --c2s-low N       resume reading client at N bytes (default: high / 2)\n"
+              << "  --s2c-high N      stop reading server when client side holds N bytes (default: buffer size)\n"
+              << "  --s2c-low N       resume reading server at N bytes (default: high / 2)\n"
+              << "  --mem-budget N    cap on bytes buffered across all links (default: unlimited)\n"
+              << "  --edge-triggered  EPOLLET, interest armed once per fd, no EPOLL_CTL_MOD\n"
+              << "  --io-uring        io_uring reactor with provided buffers, epoll if unavailable\n"
+              << "  --uring-buffers N provided recv buffers per worker (default 4096)\n"
+              << "  --log-async       write query log from a dedicated thread\n"
+              << "  --log-queue N     async log ring size in records (default 65536)\n"
+              << "  --log-block       block reactors when log ring is full instead of dropping\n"
+              << "  --max-statements N      named statements + portals tracked per link, LRU (default 4096, 0 = no cap)\n"
+              << "  --max-statement-bytes N bytes of them tracked per link (default 4194304, 0 = no cap)\n"
+              << "  --sample N        log 1 in N queries (default 1, all)\n"
+              << "  --fp-rate R       log at most R queries/s per statement text (default: no limit)\n"
+              << "  --slow-ms X       log only queries that took at least X ms\n"
+              << "  --no-response-tracking  do not read server replies: no duration/rows/errors, splice allowed\n"
+              << "  --metrics ADDR    Prometheus text over HTTP on host:port or unix:/path\n"
+              << "  --prewarm N       connected backend sockets kept ready for accepts, split between workers (epoll)\n"
+              << "  --prewarm-rate R  backend connects per second started to refill them (default 100)\n"
+              << "  --pool-size N     transaction pooling: N backends shared by all clients, split between workers\n"
+              << "  --pool-user U     role the pool logs in as, clients must ask for it (password from PGPASSWORD)\n"
+              << "  --pool-database D database of the pool (default: pool user)\n";
+}
 
 int main(int argc, char* argv[]) {
     if (getuid() != 0) {
@@ -11,9 +56,8 @@ int main(int argc, char* argv[]) {
         return 1;
     }
 
-    if (argc != 5) {
-        std::cerr << "Usage: " << argv[0]
-                  << " <listen_host> <listen_port> <db_host> <db_port>\n";
+    if (argc < 5) {
+        usage(argv[0]);
         return 1;
     }
 
@@ -22,22 +66,285 @@ int main(int argc, char* argv[]) {
     std::string db_host = argv[3];
     uint16_t db_port = static_cast<uint16_t>(std::stoi(argv[4]));
 
+    int workers = 1;
+    LoggerOptions log_options;
+    ProxyOptions proxy_options;
+    std::size_t mem_budget = 0;
+    ParserLimits parser_limits;
+    SamplingOptions sampling;
+    bool track_responses = true;
+    std::string metrics_address;
+    std::size_t pool_size = 0;
+    std::size_t prewarm = 0;
+
+    for (int i = 5; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--workers" && i + 1 < argc) {
+            workers = std::stoi(argv[++i]);
+        } else if (arg == "--buffer-size" && i + 1 < argc) {
+            proxy_options.buffer_size = std::stoul(argv[++i]);
+        } else if (arg == "--splice") {
+            proxy_options.splice = true;
+        } else if (arg == "--pipe-size" && i + 1 < argc) {
+            proxy_options.pipe_size = std::stoul(argv[++i]);
+        } else if (arg == "--c2s-high" && i + 1 < argc) {
+            proxy_options.c2s_high = std::stoul(argv[++i]);
+        } else if (arg == "--c2s-low" && i + 1 < argc) {
+            proxy_options.c2s_low = std::stoul(argv[++i]);
+        } else if (arg == "--s2c-high" && i + 1 < argc) {
+            proxy_options.s2c_high = std::stoul(argv[++i]);
+        } else if (arg == "--s2c-low" && i + 1 < argc) {
+            proxy_options.s2c_low = std::stoul(argv[++i]);
+        } else if (arg == "--mem-budget" && i + 1 < argc) {
+            mem_budget = std::stoul(argv[++i]);
+        } else if (arg == "--edge-triggered") {
+            proxy_options.edge_triggered = true;
+        } else if (arg == "--io-uring") {
+            proxy_options.io_uring = true;
+        } else if (arg == "--uring-buffers" && i + 1 < argc) {
+            proxy_options.uring_buffers = std::stoul(argv[++i]);
+        } else if (arg == "--log-async") {
+            log_options.async = true;
+        } else if (arg == "--log-queue" && i + 1 < argc) {
+            log_options.queue_size = std::stoul(argv[++i]);
+        } else if (arg == "--log-block") {
+            log_options.block_when_full = true;
+        } else if (arg == "--max-statements" && i + 1 < argc) {
+            parser_limits.max_entries = std::stoul(argv[++i]);
+        } else if (arg == "--max-statement-bytes" && i + 1 < argc) {
+            parser_limits.max_bytes = std::stoul(argv[++i]);
+        } else if (arg == "--sample" && i + 1 < argc) {
+            sampling.one_in = static_cast<std::uint32_t>(std::max(1ul, std::stoul(argv[++i])));
+        } else if (arg == "--fp-rate" && i + 1 < argc) {
+            sampling.fingerprint_rate = std::stod(argv[++i]);
+        } else if (arg == "--slow-ms" && i + 1 < argc) {
+            sampling.slow_ns = static_cast<std::int64_t>(std::stod(argv[++i]) * 1e6);
+        } else if (arg == "--no-response-tracking") {
+            track_responses = false;
+        } else if (arg == "--metrics" && i + 1 < argc) {
+            metrics_address = argv[++i];
+        } else if (arg == "--prewarm" && i + 1 < argc) {
+            prewarm = std::stoul(argv[++i]);
+        } else if (arg == "--prewarm-rate" && i + 1 < argc) {
+            proxy_options.prewarm_rate = std::stod(argv[++i]);
+        } else if (arg == "--pool-size" && i + 1 < argc) {
+            pool_size = std::stoul(argv[++i]);
+        } else if (arg == "--pool-user" && i + 1 < argc) {
+            proxy_options.pool_user = argv[++i];
+        } else if (arg == "--pool-database" && i + 1 < argc) {
+            proxy_options.pool_database = argv[++i];
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (workers < 1) {
+        std::cerr << "--workers must be >= 1\n";
+        return 1;
+    }
+
+    //  Empty ring is always full, a tiny one stalls on every message
+    if (proxy_options.buffer_size < ProxyOptions::kMinBufferSize) {
+        std::cerr << "--buffer-size must be at least " << ProxyOptions::kMinBufferSize << "\n";
+        return 1;
+    }
+
+    if (sampling.slow_ns > 0 && !track_responses) {
+        std::cerr << "--slow-ms needs response tracking\n";
+        return 1;
+    }
+
+    if (pool_size > 0) {
+        if (proxy_options.pool_user.empty()) {
+            std::cerr << "--pool-size needs --pool-user\n";
+            return 1;
+        }
+        if (pool_size < static_cast<std::size_t>(workers)) {
+            std::cerr << "--pool-size must be at least --workers\n";
+            return 1;
+        }
+        //  Pooled links frame every message, only the level-triggered epoll loop does that
+        if (proxy_options.io_uring || proxy_options.splice || proxy_options.edge_triggered || mem_budget > 0) {
+            std::cerr << "--pool-size does not combine with --io-uring, --splice, --edge-triggered or --mem-budget\n";
+            return 1;
+        }
+        if (proxy_options.pool_database.empty()) proxy_options.pool_database = proxy_options.pool_user;
+        if (const char* password = std::getenv("PGPASSWORD")) proxy_options.pool_password = password;
+    }
+
+    if (prewarm > 0 && proxy_options.prewarm_rate <= 0) {
+        std::cerr << "--prewarm-rate must be > 0\n";
+        return 1;
+    }
+    if (prewarm > 0 && pool_size > 0) {
+        std::cerr << "--prewarm is for direct links, the pool keeps its own backends\n";
+        return 1;
+    }
+
+    //  io_uring reactor has its own send path and no warm sockets,
+    //  these only matter if a worker falls back to epoll
+    if (proxy_options.io_uring) {
+        const std::pair<bool, const char*> epoll_only[] = {
+            { proxy_options.splice, "--splice" },
+            { proxy_options.edge_triggered, "--edge-triggered" },
+            { prewarm > 0, "--prewarm" },
+        };
+        for (const auto& [set, flag] : epoll_only) {
+            if (set) std::cerr << "Warning: " << flag << " is ignored by --io-uring, used only on epoll fallback\n";
+        }
+    }
+
     //  Ignore SIGPIPE, to keep app alive
     signal(SIGPIPE, SIG_IGN);
 
-    Logger logger("logs", "query");
-    Proxy proxy(listen_host, listen_port, db_host, db_port);
+    //  Shutdown signals are taken by sigwait below, workers never see them
+    sigset_t stop_signals;
+    sigemptyset(&stop_signals);
+    sigaddset(&stop_signals, SIGINT);
+    sigaddset(&stop_signals, SIGTERM);
+#ifdef PG_PROXY_PROFILE
+    sigaddset(&stop_signals, SIGUSR1);  //  Profile dump, not a stop
+#endif
+    pthread_sigmask(SIG_BLOCK, &stop_signals, nullptr);
 
-    // auto interceptor = std::make_unique<RawHexInterceptor>("hex_dump.log");
-    auto interceptor = std::make_unique<PgQueryInterceptor>(&logger);
-    proxy.setInterceptor(std::move(interceptor));
+    Logger logger("logs", "query", log_options);
 
-    if (!proxy.init()) {
-        std::cerr << "Failed to init proxy\n";
-        return 1;
+    std::unique_ptr<BufferBudget> budget;
+    if (mem_budget > 0) {
+        budget = std::make_unique<BufferBudget>(mem_budget);
+        proxy_options.budget = budget.get();
+    }
+
+    //  One reactor per worker: own listener, epoll and connection table,
+    //  so client and server fd of a link are always served by one thread
+    std::vector<std::unique_ptr<Proxy>> proxies;
+    std::vector<const PgQueryInterceptor*> parsers;  //  Stats only, owned by proxies
+    Metrics metrics;
+    for (int i = 0; i < workers; i++) {
+        ProxyOptions options = proxy_options;
+        options.worker_id = i;
+        options.reuse_port = workers > 1;
+        options.prewarm = prewarm / workers + (static_cast<std::size_t>(i) < prewarm % workers ? 1 : 0);
+        options.prewarm_rate = proxy_options.prewarm_rate / workers;
+        options.pool_size = pool_size / workers + (static_cast<std::size_t>(i) < pool_size % workers ? 1 : 0);
+        if (!metrics_address.empty()) options.metrics = metrics.addWorker();
+
+        auto proxy = std::make_unique<Proxy>(listen_host, listen_port, db_host, db_port, options);
+
+        // auto interceptor = std::make_unique<RawHexInterceptor>("hex_dump.log");
+        //  Each worker keeps own buckets, the rate is split between them
+        SamplingOptions worker_sampling = sampling;
+        worker_sampling.fingerprint_rate /= workers;
+        auto interceptor = std::make_unique<PgQueryInterceptor>(&logger, parser_limits, worker_sampling,
+                                                                track_responses);
+        interceptor->setMetrics(options.metrics);
+        parsers.push_back(interceptor.get());
+        proxy->setInterceptor(std::move(interceptor));
+
+        if (!proxy->init()) {
+            std::cerr << "Failed to init proxy worker " << i << "\n";
+            return 1;
+        }
+
+        proxies.push_back(std::move(proxy));
     }
 
-    proxy.run();
+    //  Process-wide values are summed over workers at scrape time
+    std::unique_ptr<MetricsServer> metrics_server;
+    if (!metrics_address.empty()) {
+        auto sum = [&parsers](auto read) {
+            return [&parsers, read]() {
+                double total = 0;
+                for (const PgQueryInterceptor* parser : parsers) total += static_cast<double>(read(*parser));
+                return total;
+            };
+        };
+        metrics.addValue("pg_proxy_parser_bytes", "gauge", "Parser memory of all links",
+                         sum([](const PgQueryInterceptor& p) { return p.parserBytes(); }));
+        metrics.addValue("pg_proxy_parser_evictions_total", "counter", "Statements and portals dropped by the per-link cap",
+                         sum([](const PgQueryInterceptor& p) { return p.parserEvictions(); }));
+        metrics.addValue("pg_proxy_parser_evicted_executed_total", "counter", "Executes of dropped statements, not logged",
+                         sum([](const PgQueryInterceptor& p) { return p.parserEvictedExecuted(); }));
+        metrics.addValue("pg_proxy_sampled_out_total", "counter", "Queries not logged by sampling",
+                         sum([](const PgQueryInterceptor& p) { return p.sampledOut(); }));
+        metrics.addValue("pg_proxy_templates", "gauge", "Interned prepared statement texts",
+                         []() { return static_cast<double>(TemplateIntern::shared().entries()); });
+        metrics.addValue("pg_proxy_template_bytes", "gauge", "Bytes of interned statement texts",
+                         []() { return static_cast<double>(TemplateIntern::shared().bytes()); });
+        metrics.addValue("pg_proxy_log_queue_depth", "gauge", "Records waiting for the async log writer",
+                         [&logger]() { return static_cast<double>(logger.queueDepth()); });
+        metrics.addValue("pg_proxy_log_dropped_total", "counter", "Records dropped on a full log ring",
+                         [&logger]() { return static_cast<double>(logger.dropped()); });
+
+        metrics_server = std::make_unique<MetricsServer>(metrics, metrics_address);
+        if (!metrics_server->start()) {
+            std::cerr << "Failed to start metrics endpoint on " << metrics_address << "\n";
+            return 1;
+        }
+    }
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < workers; i++) {
+        threads.emplace_back([&proxies, i]() { proxies[i]->run(); });
+    }
+
+    //  Graceful stop, so async logger can drain its queue
+    //  Parser memory is reported once per second while it changes
+    std::size_t reported_bytes = 0;
+    std::uint64_t reported_evictions = 0;
+    std::uint64_t reported_evicted_executed = 0;
+    std::uint64_t reported_sampled_out = 0;
+    int sig = -1;
+    while (sig == -1) {
+        timespec tick{1, 0};
+        sig = sigtimedwait(&stop_signals, nullptr, &tick);
+        if (sig == -1 && errno != EAGAIN && errno != EINTR) {
+            perror("sigtimedwait");
+            break;
+        }
+#ifdef PG_PROXY_PROFILE
+        if (sig == SIGUSR1) {
+            profile::dump(std::cerr);
+            sig = -1;
+        }
+#endif
+
+        std::size_t bytes = 0;
+        std::size_t peak = 0;
+        std::uint64_t evictions = 0;
+        std::uint64_t evicted_executed = 0;
+        std::uint64_t sampled_out = 0;
+        for (const PgQueryInterceptor* parser : parsers) {
+            bytes += parser->parserBytes();
+            peak = std::max(peak, parser->parserPeakLinkBytes());
+            evictions += parser->parserEvictions();
+            evicted_executed += parser->parserEvictedExecuted();
+            sampled_out += parser->sampledOut();
+        }
+        if (bytes != reported_bytes || evictions != reported_evictions
+            || evicted_executed != reported_evicted_executed) {
+            TemplateIntern& templates = TemplateIntern::shared();
+            std::cerr << "Parser: bytes=" << bytes << " peak_link=" << peak
+                      << " templates=" << templates.entries() << " template_bytes=" << templates.bytes()
+                      << " evictions=" << evictions << " evicted_executed=" << evicted_executed << "\n";
+            reported_bytes = bytes;
+            reported_evictions = evictions;
+            reported_evicted_executed = evicted_executed;
+        }
+        if (sampled_out != reported_sampled_out) {
+            std::cerr << "Sampling: skipped=" << sampled_out << "\n";
+            reported_sampled_out = sampled_out;
+        }
+    }
+    std::cerr << "Signal " << sig << ", stopping\n";
+
+    for (auto& proxy : proxies) {
+        proxy->stop();
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
 
     return 0;
 }